@@ -0,0 +1,169 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "analog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hardware.h"
+#include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "pico/stdlib.h"
+
+#define ANALOG_CHANNELS      3   // VUSB, VBAT and the temperature sensor, converted round robin
+#define ANALOG_OVERSAMPLING  64  // Samples per channel averaged into one block result
+#define ANALOG_BLOCK_SAMPLES (ANALOG_CHANNELS * ANALOG_OVERSAMPLING)
+#define ANALOG_SAMPLE_RATE   6000  // Free-running conversions per second over all channels, a block completes every 32 ms
+#define ANALOG_FILTER_SHIFT  2     // Exponential filter across blocks, each block moves the result by a quarter
+#define ANALOG_FRACTION_BITS 4
+
+static const uint8_t analog_inputs[ANALOG_CHANNELS] = {ANALOG_VUSB_ADC, ANALOG_VBAT_ADC, ANALOG_TEMP_ADC};
+
+static uint16_t analog_samples[2][ANALOG_BLOCK_SAMPLES];  // Ping-pong buffers, each filled by its own DMA channel
+static int      analog_dma_channel[2] = {-1, -1};
+
+static volatile uint32_t analog_filtered[ANALOG_CHANNELS];  // Fixed point with ANALOG_FRACTION_BITS fractional bits
+static volatile bool     analog_filter_primed = false;
+static volatile bool     analog_on_demand     = false;
+static volatile bool     analog_bursting      = false;
+
+static void analog_block(const uint16_t* samples) {
+    // The block length is a multiple of the channel count, so every block starts with the first input
+    uint32_t sums[ANALOG_CHANNELS] = {0};
+    for (uint index = 0; index < ANALOG_BLOCK_SAMPLES; index += ANALOG_CHANNELS) {
+        for (uint channel = 0; channel < ANALOG_CHANNELS; channel++) {
+            sums[channel] += samples[index + channel];
+        }
+    }
+
+    for (uint channel = 0; channel < ANALOG_CHANNELS; channel++) {
+        uint32_t average = (sums[channel] << ANALOG_FRACTION_BITS) / ANALOG_OVERSAMPLING;
+        if (!analog_filter_primed || analog_bursting) {
+            analog_filtered[channel] = average;  // Start from the first result, a burst replaces the value outright
+        } else {
+            int32_t delta            = (int32_t) average - (int32_t) analog_filtered[channel];
+            analog_filtered[channel] = analog_filtered[channel] + (delta >> ANALOG_FILTER_SHIFT);
+        }
+    }
+    analog_filter_primed = true;
+}
+
+static void analog_start(bool burst);
+
+static void __not_in_flash_func(analog_dma_handler)() {
+    for (uint buffer = 0; buffer < 2; buffer++) {
+        uint channel = analog_dma_channel[buffer];
+        if (!dma_channel_get_irq1_status(channel)) continue;
+        dma_channel_acknowledge_irq1(channel);
+
+        // Rewind for the next round, the other channel is filling its buffer in the meantime
+        dma_channel_set_write_addr(channel, analog_samples[buffer], false);
+
+        if (analog_bursting) {
+            adc_run(false);
+            analog_block(analog_samples[buffer]);
+            analog_bursting = false;
+            if (!analog_on_demand) analog_start(false);  // Resume free-running conversions
+            return;
+        } else if (!analog_on_demand) {
+            analog_block(analog_samples[buffer]);
+        }
+    }
+}
+
+static void analog_start(bool burst) {
+    adc_run(false);
+
+    // Abort both channels at once, otherwise the chain would restart the one aborted first
+    uint32_t mask = (1u << analog_dma_channel[0]) | (1u << analog_dma_channel[1]);
+    dma_hw->abort = mask;
+    while (dma_hw->abort & mask) {
+        tight_loop_contents();
+    }
+
+    for (uint buffer = 0; buffer < 2; buffer++) {
+        dma_channel_acknowledge_irq1(analog_dma_channel[buffer]);
+        dma_channel_set_write_addr(analog_dma_channel[buffer], analog_samples[buffer], false);
+        dma_channel_set_trans_count(analog_dma_channel[buffer], ANALOG_BLOCK_SAMPLES, false);
+    }
+    while (!(adc_hw->cs & ADC_CS_READY_BITS)) {
+        tight_loop_contents();
+    }
+    adc_fifo_drain();
+
+    // A burst runs back-to-back conversions (96 ADC clocks each), free-running mode paces them with the divider
+    adc_set_clkdiv(burst ? 0 : (clock_get_hz(clk_adc) / ANALOG_SAMPLE_RATE) - 1);
+    adc_select_input(analog_inputs[0]);
+    analog_bursting = burst;
+    dma_channel_start(analog_dma_channel[0]);
+    adc_run(true);
+}
+
+void analog_init() {
+    adc_init();
+    adc_gpio_init(ANALOG_VBAT_PIN);
+    adc_gpio_init(ANALOG_VUSB_PIN);
+    adc_set_temp_sensor_enabled(true);
+
+    uint32_t round_robin = 0;
+    for (uint channel = 0; channel < ANALOG_CHANNELS; channel++) {
+        round_robin |= 1 << analog_inputs[channel];
+    }
+    adc_set_round_robin(round_robin);
+    adc_fifo_setup(true, true, 1, false, false);  // Request DMA for every sample, keep the full 12 bits
+
+    analog_dma_channel[0] = dma_claim_unused_channel(true);
+    analog_dma_channel[1] = dma_claim_unused_channel(true);
+
+    // Two channels chained to each other keep the ADC FIFO drained without any CPU involvement
+    for (uint buffer = 0; buffer < 2; buffer++) {
+        dma_channel_config config = dma_channel_get_default_config(analog_dma_channel[buffer]);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_dreq(&config, DREQ_ADC);
+        channel_config_set_chain_to(&config, analog_dma_channel[buffer ^ 1]);
+        dma_channel_configure(analog_dma_channel[buffer], &config, analog_samples[buffer], &adc_hw->fifo, ANALOG_BLOCK_SAMPLES, false);
+        dma_channel_set_irq1_enabled(analog_dma_channel[buffer], true);
+    }
+    irq_add_shared_handler(DMA_IRQ_1, analog_dma_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    analog_start(false);
+}
+
+void analog_set_on_demand(bool enable) {
+    if (enable == analog_on_demand) return;
+    uint32_t state   = save_and_disable_interrupts();  // The DMA interrupt handler restarts the ADC as well
+    analog_on_demand = enable;
+    if (!analog_bursting) {  // Otherwise the running burst picks up the new mode when it completes
+        if (enable) {
+            adc_run(false);
+        } else {
+            analog_start(false);
+        }
+    }
+    restore_interrupts(state);
+}
+
+void analog_trigger() {
+    uint32_t state = save_and_disable_interrupts();
+    if (!analog_bursting) analog_start(true);
+    restore_interrupts(state);
+}
+
+bool analog_busy() { return analog_bursting; }
+
+bool analog_ready() { return analog_filter_primed; }
+
+uint16_t analog_vusb() { return analog_filtered[0] >> ANALOG_FRACTION_BITS; }
+
+uint16_t analog_vbat() { return analog_filtered[1] >> ANALOG_FRACTION_BITS; }
+
+uint16_t analog_temperature() { return analog_filtered[2] >> ANALOG_FRACTION_BITS; }
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void analog_init();
+
+void analog_set_on_demand(bool enable);  // Stop free-running conversions, values only update on a burst capture
+void analog_trigger();                   // Start a burst capture at the full ADC rate
+bool analog_busy();                      // A burst capture is in progress
+bool analog_ready();                     // The first block completed, the values below are valid
+
+// Filtered 12-bit conversion results
+uint16_t analog_vusb();
+uint16_t analog_vbat();
+uint16_t analog_temperature();
@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "battery.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BATTERY_ADC_REFERENCE_MV 3300
+#define BATTERY_ADC_DIVIDER      2     // Both VBAT and VUSB pass through a 1:2 resistor divider
+#define BATTERY_USB_PRESENT_MV   4000  // VUSB level above which the charger is powered
+#define BATTERY_CHARGE_RISE_MV   100   // Cell voltage raised by the charge current, removed before the curve lookup
+#define BATTERY_FILTER_SHIFT     4     // Exponential filter on the cell voltage, time constant of 16 updates (4 seconds)
+#define BATTERY_HYSTERESIS       2     // Percent the state of charge has to move back before a threshold fires again
+
+typedef struct {
+    uint16_t millivolts;
+    uint8_t  percent;
+} battery_curve_point_t;
+
+// Open circuit discharge curve of a single Li-ion cell at room temperature
+static const battery_curve_point_t battery_curve[] = {
+    {3300, 0},  {3600, 5},  {3680, 10}, {3710, 15}, {3730, 20}, {3750, 25}, {3770, 30},
+    {3790, 35}, {3800, 40}, {3820, 45}, {3840, 50}, {3850, 55}, {3870, 60}, {3910, 65},
+    {3950, 70}, {3980, 75}, {4020, 80}, {4080, 85}, {4110, 90}, {4150, 95}, {4200, 100},
+};
+
+static int8_t battery_vbat_offset = 0;
+static int8_t battery_vbat_gain   = 0;
+static int8_t battery_vusb_offset = 0;
+static int8_t battery_vusb_gain   = 0;
+
+static uint8_t battery_threshold_low  = 0;
+static uint8_t battery_threshold_high = 0;
+static bool    battery_low_armed      = true;
+static bool    battery_high_armed     = true;
+
+static uint32_t battery_filtered = 0;  // Cell voltage in mV with BATTERY_FILTER_SHIFT fractional bits
+static bool     battery_primed   = false;
+static uint16_t battery_vbat     = 0;
+static uint16_t battery_vusb     = 0;
+static uint8_t  battery_percent  = 0;
+static uint8_t  battery_charge   = BATTERY_STATE_DISCHARGING;
+
+static uint16_t battery_convert(uint16_t raw, int8_t offset, int8_t gain) {
+    int32_t millivolts = ((int32_t) raw * BATTERY_ADC_REFERENCE_MV * BATTERY_ADC_DIVIDER) / 4096;
+    millivolts         = millivolts + (millivolts * gain) / 1000 + offset;
+    return (millivolts < 0) ? 0 : millivolts;
+}
+
+static uint8_t battery_lookup(int32_t millivolts) {
+    const uint count = sizeof(battery_curve) / sizeof(battery_curve[0]);
+    if (millivolts <= battery_curve[0].millivolts) return 0;
+    for (uint index = 1; index < count; index++) {
+        const battery_curve_point_t* upper = &battery_curve[index];
+        if (millivolts < upper->millivolts) {
+            const battery_curve_point_t* lower = &battery_curve[index - 1];
+            return lower->percent + ((millivolts - lower->millivolts) * (upper->percent - lower->percent)) / (upper->millivolts - lower->millivolts);
+        }
+    }
+    return 100;
+}
+
+void battery_init() {
+    battery_primed     = false;
+    battery_low_armed  = true;
+    battery_high_armed = true;
+}
+
+uint8_t battery_task(uint16_t vbat_raw, uint16_t vusb_raw, bool charging) {
+    uint8_t events = 0;
+
+    battery_vbat = battery_convert(vbat_raw, battery_vbat_offset, battery_vbat_gain);
+    battery_vusb = battery_convert(vusb_raw, battery_vusb_offset, battery_vusb_gain);
+
+    uint8_t state = BATTERY_STATE_DISCHARGING;
+    if (charging) {
+        state = BATTERY_STATE_CHARGING;
+    } else if (battery_vusb >= BATTERY_USB_PRESENT_MV) {
+        state = BATTERY_STATE_CHARGED;
+    }
+
+    if (!battery_primed) {
+        battery_filtered = (uint32_t) battery_vbat << BATTERY_FILTER_SHIFT;
+    } else {
+        battery_filtered = battery_filtered - (battery_filtered >> BATTERY_FILTER_SHIFT) + battery_vbat;
+    }
+
+    int32_t cell = battery_filtered >> BATTERY_FILTER_SHIFT;
+    if (state == BATTERY_STATE_CHARGING) cell -= BATTERY_CHARGE_RISE_MV;
+    uint8_t percent = (state == BATTERY_STATE_CHARGED) ? 100 : battery_lookup(cell);
+
+    if (!battery_primed || (state != battery_charge)) {
+        if (battery_primed) events |= BATTERY_EVENT_STATE;
+        battery_percent = percent;  // Start over from the curve when the current direction changes
+    } else if ((state == BATTERY_STATE_DISCHARGING) && (percent < battery_percent)) {
+        battery_percent = percent;  // Only ever go down while discharging, load spikes would otherwise make the value jump
+    } else if ((state != BATTERY_STATE_DISCHARGING) && (percent > battery_percent)) {
+        battery_percent = percent;  // And only ever go up while charging
+    }
+    battery_charge = state;
+    battery_primed = true;
+
+    if (battery_percent > battery_threshold_low + BATTERY_HYSTERESIS) {
+        battery_low_armed = true;
+    } else if (battery_low_armed && battery_threshold_low && (battery_percent <= battery_threshold_low)) {
+        battery_low_armed = false;
+        events |= BATTERY_EVENT_LOW;
+    }
+
+    if (battery_percent + BATTERY_HYSTERESIS < battery_threshold_high) {
+        battery_high_armed = true;
+    } else if (battery_high_armed && battery_threshold_high && (battery_percent >= battery_threshold_high)) {
+        battery_high_armed = false;
+        events |= BATTERY_EVENT_HIGH;
+    }
+
+    return events;
+}
+
+void battery_set_thresholds(uint8_t low, uint8_t high) {
+    battery_threshold_low  = low;
+    battery_threshold_high = high;
+    battery_low_armed      = true;
+    battery_high_armed     = true;
+}
+
+void battery_set_calibration(int8_t vbat_offset, int8_t vbat_gain, int8_t vusb_offset, int8_t vusb_gain) {
+    battery_vbat_offset = vbat_offset;
+    battery_vbat_gain   = vbat_gain;
+    battery_vusb_offset = vusb_offset;
+    battery_vusb_gain   = vusb_gain;
+}
+
+uint16_t battery_vbat_mv() { return battery_vbat; }
+
+uint16_t battery_vusb_mv() { return battery_vusb; }
+
+uint8_t battery_soc() { return battery_percent; }
+
+uint8_t battery_state() { return battery_charge; }
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+    BATTERY_STATE_DISCHARGING,  // Running from the battery, no USB power
+    BATTERY_STATE_CHARGING,
+    BATTERY_STATE_CHARGED,      // USB power present, charger finished
+};
+
+enum {
+    BATTERY_EVENT_STATE = 0x01,  // Charge state changed, only reported, the threshold events raise the interrupt
+    BATTERY_EVENT_LOW   = 0x02,  // State of charge dropped to the low threshold
+    BATTERY_EVENT_HIGH  = 0x04,  // State of charge rose to the high threshold
+};
+
+void    battery_init();
+uint8_t battery_task(uint16_t vbat_raw, uint16_t vusb_raw, bool charging);  // Call every 250 ms, returns new events
+
+void battery_set_thresholds(uint8_t low, uint8_t high);  // In percent, 0 disables a threshold
+void battery_set_calibration(int8_t vbat_offset, int8_t vbat_gain, int8_t vusb_offset, int8_t vusb_gain);  // Offset in mV, gain in 0.1% steps
+
+uint16_t battery_vbat_mv();
+uint16_t battery_vusb_mv();
+uint8_t  battery_soc();  // State of charge in percent
+uint8_t  battery_state();
@@ -0,0 +1,250 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "buttons.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hardware.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "pico/stdlib.h"
+
+#define BUTTONS_COUNT            16
+#define BUTTONS_DEBOUNCE_DEFAULT 5   // Samples, the scan runs every millisecond while a button is bouncing
+#define BUTTONS_QUEUE_SIZE       32  // Must be a power of two
+
+typedef struct {
+    uint8_t  button;
+    uint8_t  type;
+    uint32_t timestamp;
+} button_event_t;
+
+#define NO_GPIO 0xFF
+
+// GPIO per button number, SELECT is polled by the caller and the FPGA CDONE bit in INPUT1 is not a button
+static const uint8_t buttons_gpios[BUTTONS_COUNT] = {
+    BUTTON_HOME,  BUTTON_MENU,  BUTTON_START, BUTTON_ACCEPT, BUTTON_BACK,  NO_GPIO, NO_GPIO, NO_GPIO,
+    BUTTON_JOY_A, BUTTON_JOY_B, BUTTON_JOY_C, BUTTON_JOY_D, BUTTON_JOY_E, NO_GPIO, NO_GPIO, NO_GPIO,
+};
+
+static uint8_t  buttons_integrator[BUTTONS_COUNT];  // Counts up while pressed and down while released, between 0 and the debounce limit
+static uint32_t buttons_edge_time[BUTTONS_COUNT];   // First edge of the current bounce, in milliseconds since boot
+static uint32_t buttons_hold_time[BUTTONS_COUNT];   // Time of the next long press or repeat event of a held button
+static uint8_t  buttons_debounce = BUTTONS_DEBOUNCE_DEFAULT;
+static uint16_t buttons_long     = 0;  // Hold time before a long press event in milliseconds, 0 disables
+static uint16_t buttons_repeat   = 0;  // Interval of repeat events while held in milliseconds, 0 disables
+
+// The edge interrupt, the scan timer and the I2C interrupt run at the same priority and never preempt each other
+static volatile uint16_t buttons_pending  = 0;  // Buttons with an edge that did not settle yet
+static volatile uint16_t buttons_level    = 0;
+static volatile uint16_t buttons_changed  = 0;
+static volatile uint16_t buttons_holding  = 0;  // Held buttons still waiting for a long press or repeat event
+static volatile uint16_t buttons_repeated = 0;  // Held buttons that already sent their first hold event
+static volatile bool     buttons_scanning = false;
+static repeating_timer_t buttons_timer;
+static void (*buttons_activity)() = NULL;
+
+static button_event_t   buttons_queue[BUTTONS_QUEUE_SIZE];
+static volatile uint8_t buttons_head     = 0;  // Written by the scan timer
+static volatile uint8_t buttons_tail     = 0;  // Written by the I2C interrupt handler
+static volatile uint8_t buttons_position = 0;  // Byte position within the oldest event
+static volatile bool    buttons_overflow = false;
+
+static void buttons_push(uint8_t button, uint8_t type, uint32_t timestamp) {
+    uint8_t head = (buttons_head + 1) & (BUTTONS_QUEUE_SIZE - 1);
+    if (head == buttons_tail) {
+        buttons_overflow = true;  // Keep the oldest events, the ESP32 sees them in order
+        return;
+    }
+    buttons_queue[buttons_head] = (button_event_t){.button = button, .type = type, .timestamp = timestamp};
+    buttons_head                = head;
+}
+
+static void buttons_change(uint8_t button, bool pressed, uint32_t timestamp) {
+    uint16_t bit = 1 << button;
+    buttons_changed  |= bit;
+    buttons_repeated &= ~bit;
+    if (pressed) {
+        buttons_level |= bit;
+        if (buttons_long || buttons_repeat) {
+            buttons_holding           |= bit;
+            buttons_hold_time[button]  = timestamp + (buttons_long ? buttons_long : buttons_repeat);
+        }
+    } else {
+        buttons_level   &= ~bit;
+        buttons_holding &= ~bit;
+    }
+    buttons_push(button, pressed ? BUTTON_EVENT_PRESS : BUTTON_EVENT_RELEASE, timestamp);
+}
+
+static void buttons_hold(uint8_t button, uint32_t now) {
+    uint16_t bit = 1 << button;
+    if ((int32_t) (now - buttons_hold_time[button]) < 0) return;
+
+    // The first hold event is a long press when enabled, every following one a repeat
+    bool repeat = (buttons_repeated & bit) || !buttons_long;
+    buttons_push(button, repeat ? BUTTON_EVENT_REPEAT : BUTTON_EVENT_LONG_PRESS, now);
+    buttons_repeated |= bit;
+    if (buttons_repeat) {
+        buttons_hold_time[button] += buttons_repeat;
+    } else {
+        buttons_holding &= ~bit;
+    }
+}
+
+static bool __not_in_flash_func(buttons_scan)(repeating_timer_t* timer) {
+    uint32_t gpios = gpio_get_all();
+    uint32_t now   = to_ms_since_boot(get_absolute_time());
+
+    for (uint8_t button = 0; button < BUTTONS_COUNT; button++) {
+        uint16_t bit = 1 << button;
+        if (buttons_holding & bit) buttons_hold(button, now);
+        if (!(buttons_pending & bit)) continue;
+
+        // Integrate the raw level, the buttons are active low
+        bool pressed = !(gpios & (1 << buttons_gpios[button]));
+        if (pressed && (buttons_integrator[button] < buttons_debounce)) {
+            buttons_integrator[button]++;
+        } else if (!pressed && (buttons_integrator[button] > 0)) {
+            buttons_integrator[button]--;
+        }
+
+        bool level = buttons_level & bit;
+        if (!level && (buttons_integrator[button] >= buttons_debounce)) {
+            buttons_pending &= ~bit;
+            buttons_change(button, true, buttons_edge_time[button]);
+        } else if (level && (buttons_integrator[button] == 0)) {
+            buttons_pending &= ~bit;
+            buttons_change(button, false, buttons_edge_time[button]);
+        } else if (buttons_integrator[button] == (level ? buttons_debounce : 0)) {
+            buttons_pending &= ~bit;  // Bounced back to the accepted level
+        }
+    }
+
+    buttons_scanning = (buttons_pending != 0) || (buttons_holding != 0);
+    return buttons_scanning;  // Stop the timer once every button settled and no hold events are due
+}
+
+static void buttons_start_scan() {
+    if (!buttons_scanning) {
+        buttons_scanning = add_repeating_timer_us(-1000, buttons_scan, NULL, &buttons_timer);
+    }
+}
+
+static void __not_in_flash_func(buttons_edge)() {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    for (uint8_t button = 0; button < BUTTONS_COUNT; button++) {
+        if (buttons_gpios[button] == NO_GPIO) continue;
+        uint32_t events = gpio_get_irq_event_mask(buttons_gpios[button]) & (GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE);
+        if (!events) continue;
+        gpio_acknowledge_irq(buttons_gpios[button], events);
+        if (!(buttons_pending & (1 << button))) {
+            buttons_edge_time[button] = now;  // Timestamp the first edge, not the moment the level is accepted
+            buttons_pending |= 1 << button;
+        }
+    }
+
+    if (buttons_pending) {
+        buttons_start_scan();
+        if (buttons_activity) buttons_activity();
+    }
+}
+
+void buttons_init() {
+    uint32_t mask  = 0;
+    uint32_t gpios = gpio_get_all();
+    for (uint8_t button = 0; button < BUTTONS_COUNT; button++) {
+        if (buttons_gpios[button] == NO_GPIO) continue;
+        mask |= 1 << buttons_gpios[button];
+        if (!(gpios & (1 << buttons_gpios[button]))) {
+            buttons_level |= 1 << button;
+            buttons_integrator[button] = buttons_debounce;
+        }
+    }
+
+    gpio_add_raw_irq_handler_masked(mask, buttons_edge);
+    for (uint8_t button = 0; button < BUTTONS_COUNT; button++) {
+        if (buttons_gpios[button] == NO_GPIO) continue;
+        gpio_set_irq_enabled(buttons_gpios[button], GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+    }
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+void buttons_set_activity_callback(void (*callback)()) { buttons_activity = callback; }
+
+uint16_t buttons_state() { return buttons_level; }
+
+void buttons_set_polled(uint8_t button, bool pressed) {
+    uint32_t state = save_and_disable_interrupts();
+    if (pressed != !!(buttons_level & (1 << button))) {
+        buttons_change(button, pressed, to_ms_since_boot(get_absolute_time()));
+        if (buttons_holding) buttons_start_scan();
+        if (buttons_activity) buttons_activity();
+    }
+    restore_interrupts(state);
+}
+
+uint16_t buttons_changes() {
+    uint32_t state   = save_and_disable_interrupts();
+    uint16_t changes = buttons_changed;
+    buttons_changed  = 0;
+    restore_interrupts(state);
+    return changes;
+}
+
+void buttons_set_debounce(uint8_t samples) {
+    if (samples == 0) samples = BUTTONS_DEBOUNCE_DEFAULT;
+    uint32_t state = save_and_disable_interrupts();
+    for (uint8_t button = 0; button < BUTTONS_COUNT; button++) {
+        // Keep the integrators on the rails of the accepted levels
+        bool level                 = buttons_level & (1 << button);
+        buttons_integrator[button] = level ? samples : 0;
+    }
+    buttons_debounce = samples;
+    restore_interrupts(state);
+}
+
+void buttons_set_hold(uint16_t long_press, uint16_t repeat) {
+    uint32_t state  = save_and_disable_interrupts();
+    buttons_long    = long_press;
+    buttons_repeat  = repeat;
+    buttons_holding = 0;  // Buttons held right now do not send hold events, the next press uses the new timing
+    restore_interrupts(state);
+}
+
+uint8_t __not_in_flash_func(buttons_event_count)() { return (buttons_head - buttons_tail) & (BUTTONS_QUEUE_SIZE - 1); }
+
+uint8_t __not_in_flash_func(buttons_event_read)() {
+    if (buttons_head == buttons_tail) return 0;
+    button_event_t* event = &buttons_queue[buttons_tail];
+
+    uint8_t value;
+    if (buttons_position == 0) {
+        value = event->button;
+    } else if (buttons_position == 1) {
+        value = event->type;
+    } else {
+        value = event->timestamp >> ((buttons_position - 2) * 8);
+    }
+
+    buttons_position = buttons_position + 1;
+    if (buttons_position >= BUTTON_EVENT_SIZE) {
+        buttons_position = 0;
+        buttons_tail     = (buttons_tail + 1) & (BUTTONS_QUEUE_SIZE - 1);
+    }
+    return value;
+}
+
+void __not_in_flash_func(buttons_event_restart)() { buttons_position = 0; }
+
+bool buttons_overflowed() {
+    bool overflowed  = buttons_overflow;
+    buttons_overflow = false;
+    return overflowed;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Button numbers match the bit positions in the INPUT1 (0-7) and INPUT2 (8-15) registers
+enum {
+    BUTTON_EVENT_RELEASE,
+    BUTTON_EVENT_PRESS,
+    BUTTON_EVENT_LONG_PRESS,  // Held for the long press time, sent once per press
+    BUTTON_EVENT_REPEAT,      // Sent at the repeat interval while held
+};
+
+#define BUTTON_EVENT_SIZE 6  // Button number, event type, 32-bit little endian timestamp in milliseconds
+
+void buttons_init();
+void buttons_set_activity_callback(void (*callback)());  // Called from the edge interrupt on every button edge
+
+uint16_t buttons_state();                                         // Debounced levels, a set bit means pressed
+uint16_t buttons_changes();                                       // Buttons that changed since the previous call, even when they changed back
+void     buttons_set_debounce(uint8_t samples);                   // Consecutive 1 ms samples needed to accept a new level
+void     buttons_set_hold(uint16_t long_press, uint16_t repeat);  // In milliseconds, 0 disables the event type
+void     buttons_set_polled(uint8_t button, bool pressed);        // Level of a button without a GPIO interrupt, sampled by the caller
+
+// Event queue, read through a streaming window from the I2C interrupt handler
+uint8_t buttons_event_count();
+uint8_t buttons_event_read();     // Returns the next byte, an event is removed after its last byte
+void    buttons_event_restart();  // Start over at the first byte of the oldest event
+bool    buttons_overflowed();     // Returns true once after events were lost
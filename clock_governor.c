@@ -0,0 +1,169 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "clock_governor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "battery.h"
+#include "esp32_loader.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+#include "i2c_peripheral.h"
+#include "ir.h"
+#include "lcd.h"
+#include "pico/stdlib.h"
+#include "profiler.h"
+#include "trace.h"
+#include "tusb.h"
+#include "uart_dma.h"
+#include "uart_stats.h"
+#include "usb_benchmark.h"
+#include "ws2812.h"
+
+#define CLOCK_GOVERNOR_INTERVAL_US 10000   // Demand is evaluated every 10 ms
+#define CLOCK_GOVERNOR_HOLD_US     500000  // Stay boosted this long after the last demand
+
+static uint32_t      clock_governor_pll_hz    = 0;
+static uint32_t      clock_governor_usb_hz    = 0;
+static bool          clock_governor_on        = true;
+static bool          clock_governor_suspended = false;
+static volatile bool clock_governor_demanded  = false;  // Set from the I2C interrupt handler
+static uint8_t       clock_governor_current   = CLOCK_LEVEL_BOOST;
+static uint8_t       clock_governor_target    = CLOCK_LEVEL_BOOST;
+static uint64_t      clock_governor_evaluated = 0;
+static uint64_t      clock_governor_boost_end = 0;
+static uint32_t      clock_governor_bytes[UART_DMA_PORTS];  // Bridge byte counters at the last evaluation
+
+static uint64_t clock_governor_residency_us[CLOCK_LEVELS];
+static uint64_t clock_governor_since = 0;  // Start of the time not yet added to the residency of the current level
+
+static void clock_governor_account() {
+    uint64_t now = time_us_64();
+    clock_governor_residency_us[clock_governor_current] += now - clock_governor_since;
+    clock_governor_since = now;
+}
+
+static uint32_t clock_governor_level_hz(uint8_t level) {
+    switch (level) {
+        case CLOCK_LEVEL_NORMAL:
+            // clk_sys stays at or above clk_usb, builds with a slow exact baud rate clock don't scale down here
+            return (clock_governor_pll_hz / 2 >= clock_governor_usb_hz) ? clock_governor_pll_hz / 2 : clock_governor_pll_hz;
+        case CLOCK_LEVEL_IDLE:
+            return clock_governor_usb_hz;
+        default:
+            return clock_governor_pll_hz;
+    }
+}
+
+static bool clock_governor_apply(uint8_t level) {
+    uint32_t hz = clock_governor_level_hz(level);
+
+    // IR frames and LED data are timed with the divider they started with, switch once they have been shifted out
+    if (ir_busy() || ws2812_busy()) return false;
+
+    uint32_t state = save_and_disable_interrupts();
+    if (!i2c_idle()) {  // Retiming the I2C block would cut off the transfer in progress, try again on the next loop
+        restore_interrupts(state);
+        return false;
+    }
+    if (level == CLOCK_LEVEL_IDLE) {
+        clock_configure(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX, CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, clock_governor_usb_hz, hz);
+    } else {
+        clock_configure(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX, CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS, clock_governor_pll_hz, hz);
+    }
+    // Everything clocked from clk_sys derives its timing again, the UARTs run from clk_peri and don't notice
+    i2c_clock_changed();
+    lcd_clock_changed();
+    ws2812_clock_changed();
+    ir_clock_changed();
+    profiler_clock_changed();
+    restore_interrupts(state);
+
+    clock_governor_account();
+    clock_governor_current = level;
+    trace_event(TRACE_EVENT_CLOCK, level, hz / 1000000);
+    return true;
+}
+
+static bool clock_governor_busy() {
+    bool busy               = clock_governor_demanded;
+    clock_governor_demanded = false;
+
+    for (uint8_t port = 0; port < UART_DMA_PORTS; port++) {
+        uint32_t bytes = uart_stats_bytes(port);
+        if (bytes != clock_governor_bytes[port]) busy = true;  // Also true when the counters were reset, which is harmless
+        clock_governor_bytes[port] = bytes;
+    }
+
+    return busy || esp32_loader_active() || usb_benchmark_active(0) || usb_benchmark_active(1) || ir_busy();
+}
+
+void clock_governor_init() {
+    clock_governor_pll_hz = clock_get_hz(clk_sys);
+    clock_governor_usb_hz = clock_get_hz(clk_usb);
+
+    // The UARTs get their own copy of the pll_sys rate, their baud rate dividers never change with clk_sys
+    clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS, clock_governor_pll_hz, clock_governor_pll_hz);
+
+    clock_governor_since = time_us_64();
+}
+
+void clock_governor_task() {
+    uint64_t now = time_us_64();
+    if (now - clock_governor_evaluated >= CLOCK_GOVERNOR_INTERVAL_US) {
+        clock_governor_evaluated = now;
+        if (clock_governor_busy()) clock_governor_boost_end = now + CLOCK_GOVERNOR_HOLD_US;
+
+        if (!clock_governor_on || now < clock_governor_boost_end) {
+            clock_governor_target = CLOCK_LEVEL_BOOST;
+        } else if (clock_governor_suspended || (!tud_mounted() && battery_state() == BATTERY_STATE_DISCHARGING)) {
+            clock_governor_target = CLOCK_LEVEL_IDLE;
+        } else {
+            clock_governor_target = CLOCK_LEVEL_NORMAL;
+        }
+    }
+
+    if (clock_governor_target != clock_governor_current) clock_governor_apply(clock_governor_target);
+}
+
+void clock_governor_set_enabled(bool enabled) {
+    clock_governor_on = enabled;
+    if (!enabled) {
+        clock_governor_target = CLOCK_LEVEL_BOOST;  // Don't wait for the next evaluation
+    }
+}
+
+bool clock_governor_enabled() { return clock_governor_on; }
+
+void clock_governor_demand() { clock_governor_demanded = true; }
+
+void clock_governor_usb_suspended(bool suspended) {
+    clock_governor_suspended = suspended;
+    clock_governor_evaluated = 0;  // React on the next loop instead of up to one interval later
+}
+
+uint8_t clock_governor_level() { return clock_governor_current; }
+
+uint32_t clock_governor_hz() { return clock_get_hz(clk_sys); }
+
+uint8_t clock_governor_residency(uint8_t level) {
+    if (level >= CLOCK_LEVELS) return 0;
+    clock_governor_account();
+    uint64_t total = 0;
+    for (uint8_t index = 0; index < CLOCK_LEVELS; index++) {
+        total += clock_governor_residency_us[index];
+    }
+    if (total == 0) return (level == clock_governor_current) ? 100 : 0;
+    return (clock_governor_residency_us[level] * 100) / total;
+}
+
+void clock_governor_reset_residency() {
+    memset(clock_governor_residency_us, 0, sizeof(clock_governor_residency_us));
+    clock_governor_since = time_us_64();
+}
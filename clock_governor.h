@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+    CLOCK_LEVEL_BOOST,   // clk_sys at the full pll_sys rate, bridge traffic, ESP32 flashing, benchmarks, LED and IR work
+    CLOCK_LEVEL_NORMAL,  // Half the pll_sys rate, USB mounted without traffic
+    CLOCK_LEVEL_IDLE,    // 48 MHz from pll_usb, USB suspended or running from the battery
+    CLOCK_LEVELS,
+};
+
+void clock_governor_init();  // Moves clk_peri to pll_sys, call before the UARTs are set up
+void clock_governor_task();
+
+void clock_governor_set_enabled(bool enabled);  // Disabled keeps clk_sys at the boost rate
+bool clock_governor_enabled();
+void clock_governor_demand();  // Boosts for a while, for work the governor can't see, safe from interrupt handlers
+void clock_governor_usb_suspended(bool suspended);
+
+uint8_t  clock_governor_level();
+uint32_t clock_governor_hz();
+uint8_t  clock_governor_residency(uint8_t level);  // Percentage of the time spent at the level since the last reset
+void     clock_governor_reset_residency();
@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "console_history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "uart_dma.h"
+
+// Sizes must be powers of two
+#define CONSOLE_HISTORY_ESP32_SIZE  32768
+#define CONSOLE_HISTORY_ESP32_LINES 2048
+#define CONSOLE_HISTORY_FPGA_SIZE   8192
+#define CONSOLE_HISTORY_FPGA_LINES  256
+#define CONSOLE_HISTORY_PREFIX_SIZE 16  // "[12345678.123] "
+
+typedef struct {
+    uint8_t*  data;
+    uint32_t  size;
+    uint32_t  head;  // Bytes captured, free running
+    uint32_t* line_positions;
+    uint32_t* line_times;  // Milliseconds since boot
+    uint32_t  line_count;  // Lines started, free running
+    uint32_t  lines;       // Entries in the line tables
+    bool      line_start;  // The next byte starts a line
+
+    bool     replaying;
+    uint32_t replay_position;
+    uint32_t replay_line;  // Next line start to prefix
+} console_history_t;
+
+static uint8_t  console_history_esp32_data[CONSOLE_HISTORY_ESP32_SIZE];
+static uint32_t console_history_esp32_positions[CONSOLE_HISTORY_ESP32_LINES];
+static uint32_t console_history_esp32_times[CONSOLE_HISTORY_ESP32_LINES];
+static uint8_t  console_history_fpga_data[CONSOLE_HISTORY_FPGA_SIZE];
+static uint32_t console_history_fpga_positions[CONSOLE_HISTORY_FPGA_LINES];
+static uint32_t console_history_fpga_times[CONSOLE_HISTORY_FPGA_LINES];
+
+static console_history_t console_histories[UART_DMA_PORTS] = {
+    {console_history_esp32_data, CONSOLE_HISTORY_ESP32_SIZE, 0, console_history_esp32_positions, console_history_esp32_times, 0, CONSOLE_HISTORY_ESP32_LINES, true},
+    {console_history_fpga_data, CONSOLE_HISTORY_FPGA_SIZE, 0, console_history_fpga_positions, console_history_fpga_times, 0, CONSOLE_HISTORY_FPGA_LINES, true},
+};
+
+static uint32_t console_history_oldest(console_history_t* history) { return (history->head > history->size) ? history->head - history->size : 0; }
+
+static uint32_t console_history_oldest_line(console_history_t* history) {
+    // Line entries stay valid as long as the table and the data still hold them
+    uint32_t line = (history->line_count > history->lines) ? history->line_count - history->lines : 0;
+    while ((line < history->line_count) && (history->line_positions[line % history->lines] < console_history_oldest(history))) line++;
+    return line;
+}
+
+static void console_history_store(console_history_t* history, const uint8_t* data, uint32_t length) {
+    uint32_t offset = history->head % history->size;
+    uint32_t linear = history->size - offset;
+    if (length > history->size) {
+        data   += length - history->size;
+        length  = history->size;
+    }
+    if (length > linear) {
+        memcpy(&history->data[offset], data, linear);
+        memcpy(history->data, &data[linear], length - linear);
+    } else {
+        memcpy(&history->data[offset], data, length);
+    }
+    history->head += length;
+}
+
+void console_history_capture(uint8_t port, const uint8_t* data, uint32_t length) {
+    console_history_t* history = &console_histories[port];
+    while (length > 0) {
+        if (history->line_start) {
+            uint32_t line                 = history->line_count % history->lines;
+            history->line_positions[line] = history->head;
+            history->line_times[line]     = to_ms_since_boot(get_absolute_time());
+            history->line_start           = false;
+            history->line_count++;
+        }
+        const uint8_t* newline = memchr(data, '\n', length);
+        uint32_t       chunk   = (newline != NULL) ? (newline - data) + 1 : length;
+        console_history_store(history, data, chunk);
+        history->line_start = (newline != NULL);
+        data               += chunk;
+        length             -= chunk;
+    }
+}
+
+void console_history_start_replay(uint8_t port) {
+    console_history_t* history = &console_histories[port];
+    history->replay_line       = console_history_oldest_line(history);
+    history->replay_position   = (history->replay_line < history->line_count) ? history->line_positions[history->replay_line % history->lines] : history->head;
+    history->replaying         = history->replay_position < history->head;
+}
+
+bool console_history_replaying(uint8_t port) { return console_histories[port].replaying; }
+
+uint32_t console_history_replay(uint8_t port, uint8_t* buffer, uint32_t capacity) {
+    console_history_t* history = &console_histories[port];
+    uint32_t           written = 0;
+    while (history->replaying && (written < capacity)) {
+        if (history->replay_position < console_history_oldest(history)) {
+            // Capturing overtook the replay, continue at the oldest line that is left
+            history->replay_line     = console_history_oldest_line(history);
+            history->replay_position = (history->replay_line < history->line_count) ? history->line_positions[history->replay_line % history->lines] : history->head;
+        }
+
+        if ((history->replay_line < history->line_count) && (history->line_positions[history->replay_line % history->lines] == history->replay_position)) {
+            if (capacity - written < CONSOLE_HISTORY_PREFIX_SIZE) break;
+            uint32_t time = history->line_times[history->replay_line % history->lines];
+            written += snprintf((char*) &buffer[written], CONSOLE_HISTORY_PREFIX_SIZE, "[%5lu.%03lu] ", (unsigned long) (time / 1000), (unsigned long) (time % 1000));
+            history->replay_line++;
+        }
+
+        // Up to the next line start, the end of the ring or the end of the buffer
+        uint32_t end = history->head;
+        if (history->replay_line < history->line_count) end = history->line_positions[history->replay_line % history->lines];
+        uint32_t offset = history->replay_position % history->size;
+        uint32_t length = end - history->replay_position;
+        if (length > history->size - offset) length = history->size - offset;
+        if (length > capacity - written) length = capacity - written;
+        memcpy(&buffer[written], &history->data[offset], length);
+        written                  += length;
+        history->replay_position += length;
+
+        if (history->replay_position >= history->head) history->replaying = false;
+    }
+    return written;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Keeps the most recent console output of both UARTs, ports as in uart_dma.h
+void console_history_capture(uint8_t port, const uint8_t* data, uint32_t length);
+
+// Replay the history with a timestamp in front of every line, live data keeps being captured until the replay caught up
+void     console_history_start_replay(uint8_t port);
+bool     console_history_replaying(uint8_t port);
+uint32_t console_history_replay(uint8_t port, uint8_t* buffer, uint32_t capacity);  // Fills at most capacity bytes
@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "crash_record.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/exception.h"
+#include "hardware/structs/watchdog.h"
+#include "hardware/watchdog.h"
+#include "pico/stdlib.h"
+
+#ifdef PICO_PANIC_FUNCTION
+// Fixed region at the end of RAM that neither the runtime nor the bootloader touch, survives the watchdog reboot after a crash
+static crash_record_t __attribute__((section(".crash_record"))) crash_record;
+#else  // Debug firmware links with the SDK linker script and doesn't reboot after a crash
+static crash_record_t __uninitialized_ram(crash_record);
+#endif
+
+static volatile uint8_t crash_record_current_task = CRASH_TASK_INIT;
+
+static uint32_t crash_record_checksum() {
+    const uint8_t* bytes    = (const uint8_t*) &crash_record;
+    uint32_t       checksum = 0;
+    for (uint32_t offset = 0; offset < offsetof(crash_record_t, checksum); offset += sizeof(uint32_t)) {
+        uint32_t word;
+        memcpy(&word, &bytes[offset], sizeof(word));
+        checksum += word;
+    }
+    return checksum;
+}
+
+static void crash_record_store(uint8_t type, uint32_t pc, uint32_t lr, uint32_t sp, uint32_t xpsr) {
+    crash_record.magic     = CRASH_RECORD_MAGIC;
+    crash_record.version   = CRASH_RECORD_VERSION;
+    crash_record.type      = type;
+    crash_record.task      = crash_record_current_task;
+    crash_record.reserved  = 0;
+    crash_record.uptime_ms = time_us_64() / 1000;
+    crash_record.pc        = pc;
+    crash_record.lr        = lr;
+    crash_record.sp        = sp;
+    crash_record.xpsr      = xpsr;
+    for (uint8_t index = 0; index < CRASH_RECORD_STACK_WORDS; index++) {
+        // A corrupted stack pointer must not fault again while taking the snapshot
+        uint32_t address          = sp + index * sizeof(uint32_t);
+        crash_record.stack[index] = ((address >= SRAM_BASE) && (address < SRAM_END)) ? *(const uint32_t*) (uintptr_t) address : 0;
+    }
+}
+
+void crash_record_panic(const uint32_t* frame, const char* fmt, va_list args) {
+    // panic() pushed the return address into its caller, the caller's stack continues after it
+    crash_record_store(CRASH_TYPE_PANIC, (uintptr_t) panic, frame[0], (uintptr_t) &frame[1], 0);
+    memset(crash_record.message, 0, sizeof(crash_record.message));
+    if (fmt != NULL) vsnprintf(crash_record.message, sizeof(crash_record.message), fmt, args);
+    crash_record.checksum = crash_record_checksum();
+}
+
+void __attribute__((used)) crash_record_hardfault(const uint32_t* frame) {
+    // Exception frame: r0, r1, r2, r3, r12, lr, pc, xpsr, the stack of the faulting code continues after it
+    crash_record_store(CRASH_TYPE_HARDFAULT, frame[6], frame[5], (uintptr_t) &frame[8], frame[7]);
+    memset(crash_record.message, 0, sizeof(crash_record.message));
+    strcpy(crash_record.message, "HardFault");
+    crash_record.checksum = crash_record_checksum();
+    crash_record_reboot();
+}
+
+static void __attribute__((naked)) crash_record_hardfault_handler() {
+    // Bit 2 of EXC_RETURN selects the stack the frame was pushed to
+    __asm volatile(
+        ".syntax unified\n"
+        "movs r0, #4\n"
+        "mov r1, lr\n"
+        "tst r0, r1\n"
+        "beq 1f\n"
+        "mrs r0, psp\n"
+        "b 2f\n"
+        "1:\n"
+        "mrs r0, msp\n"
+        "2:\n"
+        "ldr r1, =crash_record_hardfault\n"
+        "bx r1\n"
+        ".align 2\n"
+        ".ltorg\n");
+}
+
+void __attribute__((noreturn)) crash_record_reboot() {
+    hw_clear_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_ENABLE_BITS);
+    watchdog_hw->scratch[5] = CRASH_INDICATION_MAGIC;
+    watchdog_hw->scratch[6] = ~CRASH_INDICATION_MAGIC;
+    watchdog_reboot(0, 0, 0);
+    while (1) {
+        tight_loop_contents();
+        asm("");
+    }
+}
+
+void crash_record_init() {
+    // After a power cycle the section holds random data
+    if ((crash_record.magic != CRASH_RECORD_MAGIC) || (crash_record.version != CRASH_RECORD_VERSION) || (crash_record.checksum != crash_record_checksum())) {
+        crash_record_clear();
+    }
+#ifdef PICO_PANIC_FUNCTION  // Debug firmware keeps the default handler, which stops at a breakpoint
+    exception_set_exclusive_handler(HARDFAULT_EXCEPTION, crash_record_hardfault_handler);
+#endif
+}
+
+void crash_record_task(uint8_t task) { crash_record_current_task = task; }
+
+const crash_record_t* __not_in_flash_func(crash_record_get)() { return (crash_record.type != CRASH_TYPE_NONE) ? &crash_record : NULL; }
+
+void crash_record_clear() { memset(&crash_record, 0, sizeof(crash_record)); }
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CRASH_INDICATION_MAGIC 0xFA174200  // In watchdog scratch 5 and 6 (inverted) after a crash reboot
+
+#define CRASH_RECORD_MAGIC        0xC4A5B10C
+#define CRASH_RECORD_VERSION      1
+#define CRASH_RECORD_STACK_WORDS  16
+#define CRASH_RECORD_MESSAGE_SIZE 64
+
+enum { CRASH_TYPE_NONE, CRASH_TYPE_PANIC, CRASH_TYPE_HARDFAULT };
+
+// Superloop tasks, the one that was running ends up in the crash record
+enum { CRASH_TASK_INIT, CRASH_TASK_TUD, CRASH_TASK_UART, CRASH_TASK_I2C, CRASH_TASK_WEBUSB, CRASH_TASK_TRACE };
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t  version;
+    uint8_t  type;
+    uint8_t  task;
+    uint8_t  reserved;
+    uint32_t uptime_ms;
+    uint32_t pc;    // Panic: address of panic()
+    uint32_t lr;    // Panic: return address into the caller of panic()
+    uint32_t sp;    // Start of the stack snapshot
+    uint32_t xpsr;  // HardFault only
+    uint32_t stack[CRASH_RECORD_STACK_WORDS];
+    char     message[CRASH_RECORD_MESSAGE_SIZE];  // Formatted panic message, zero terminated
+    uint32_t checksum;                            // Sum of all preceding 32-bit words
+} crash_record_t;
+
+void crash_record_init();  // Keeps a valid record from before the reboot and installs the HardFault handler
+void crash_record_task(uint8_t task);
+
+const crash_record_t* crash_record_get();  // NULL when there is no record
+void                  crash_record_clear();
+
+void                           crash_record_panic(const uint32_t* frame, const char* fmt, va_list args);  // frame: SP at custom_panic() entry
+void __attribute__((noreturn)) crash_record_reboot();
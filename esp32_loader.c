@@ -0,0 +1,355 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "esp32_loader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware.h"
+#include "hardware/uart.h"
+#include "pico/stdlib.h"
+#include "uart_dma.h"
+#include "uart_flow.h"
+#include "uart_task.h"
+
+#define SLIP_END     0xC0
+#define SLIP_ESC     0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+#define ESP32_CMD_SYNC             0x08
+#define ESP32_CMD_SPI_SET_PARAMS   0x0B
+#define ESP32_CMD_SPI_ATTACH       0x0D
+#define ESP32_CMD_CHANGE_BAUDRATE  0x0F
+#define ESP32_CMD_FLASH_DEFL_BEGIN 0x10
+#define ESP32_CMD_FLASH_DEFL_DATA  0x11
+#define ESP32_CMD_SPI_FLASH_MD5    0x13
+
+#define ESP32_LOADER_ROM_BAUDRATE    115200
+#define ESP32_LOADER_BLOCK_SIZE      0x400  // FLASH_WRITE_SIZE of the ROM loader
+#define ESP32_LOADER_HEADER_SIZE     8      // Direction, command, 16-bit size and 32-bit checksum or value
+#define ESP32_LOADER_CHECKSUM_SEED   0xEF
+#define ESP32_LOADER_BOOT_TIME       100000   // us from reset until the ROM listens
+#define ESP32_LOADER_SETTLE_TIME     50000    // us after a baud rate change
+#define ESP32_LOADER_SYNC_INTERVAL   100000   // us between sync attempts
+#define ESP32_LOADER_SYNC_ATTEMPTS   20
+#define ESP32_LOADER_TIMEOUT         3000000  // us, default command timeout
+#define ESP32_LOADER_DATA_TIMEOUT    10000000
+#define ESP32_LOADER_ERASE_US_PER_MB 30000000  // Same budgets as esptool
+#define ESP32_LOADER_MD5_US_PER_MB   8000000
+
+static esp32_loader_start_t  esp32_loader_job;
+static esp32_loader_status_t esp32_loader_state = {.state = ESP32_LOADER_IDLE};
+
+// Command in flight
+static uint8_t  esp32_loader_command = 0;  // 0 when no response is expected
+static uint32_t esp32_loader_deadline;
+static uint8_t  esp32_loader_sync_attempts;
+
+// Encoded frame on its way to the UART, a full data block escapes to at most twice its size
+static uint8_t  esp32_loader_frame[2 + 2 * (ESP32_LOADER_HEADER_SIZE + 16 + ESP32_LOADER_BLOCK_SIZE)];
+static uint32_t esp32_loader_frame_length;
+static uint32_t esp32_loader_frame_sent;
+
+// Response being decoded, long enough for the MD5 response
+static uint8_t  esp32_loader_response[64];
+static uint16_t esp32_loader_response_length;
+static bool     esp32_loader_response_escape;
+
+// Next block, filled by the host while the ROM writes the previous one
+static uint8_t  esp32_loader_block[ESP32_LOADER_BLOCK_SIZE];
+static uint32_t esp32_loader_block_length;
+
+static uint8_t esp32_loader_bridge_flow;  // Restored afterwards
+
+static uint32_t esp32_loader_timeout_per_mb(uint32_t us_per_mb, uint32_t size) {
+    uint32_t timeout = ((uint64_t) us_per_mb * size) >> 20;
+    return (timeout > ESP32_LOADER_TIMEOUT) ? timeout : ESP32_LOADER_TIMEOUT;
+}
+
+static void esp32_loader_put(uint8_t byte) {
+    if (byte == SLIP_END) {
+        esp32_loader_frame[esp32_loader_frame_length++] = SLIP_ESC;
+        byte                                            = SLIP_ESC_END;
+    } else if (byte == SLIP_ESC) {
+        esp32_loader_frame[esp32_loader_frame_length++] = SLIP_ESC;
+        byte                                            = SLIP_ESC_ESC;
+    }
+    esp32_loader_frame[esp32_loader_frame_length++] = byte;
+}
+
+static void esp32_loader_put_u32(uint32_t value) {
+    for (uint8_t shift = 0; shift < 32; shift += 8) esp32_loader_put(value >> shift);
+}
+
+static void esp32_loader_send(uint8_t command, const uint32_t* words, uint8_t word_count, const uint8_t* payload, uint16_t payload_length, uint32_t checksum,
+                              uint32_t timeout) {
+    uint16_t size             = word_count * 4 + payload_length;
+    esp32_loader_frame_length = 0;
+    esp32_loader_frame_sent   = 0;
+
+    esp32_loader_frame[esp32_loader_frame_length++] = SLIP_END;
+    esp32_loader_put(0x00);  // Request
+    esp32_loader_put(command);
+    esp32_loader_put(size & 0xFF);
+    esp32_loader_put(size >> 8);
+    esp32_loader_put_u32(checksum);
+    for (uint8_t word = 0; word < word_count; word++) esp32_loader_put_u32(words[word]);
+    for (uint16_t position = 0; position < payload_length; position++) esp32_loader_put(payload[position]);
+    esp32_loader_frame[esp32_loader_frame_length++] = SLIP_END;
+
+    esp32_loader_command  = command;
+    esp32_loader_deadline = time_us_32() + timeout;
+}
+
+static void esp32_loader_send_sync() {
+    uint8_t sync[36] = {0x07, 0x07, 0x12, 0x20};
+    memset(&sync[4], 0x55, sizeof(sync) - 4);
+    esp32_loader_send(ESP32_CMD_SYNC, NULL, 0, sync, sizeof(sync), 0, ESP32_LOADER_SYNC_INTERVAL);
+}
+
+static void esp32_loader_send_block() {
+    uint32_t words[4] = {esp32_loader_block_length, esp32_loader_state.blocks_written, 0, 0};
+    uint32_t checksum = ESP32_LOADER_CHECKSUM_SEED;
+    for (uint32_t position = 0; position < esp32_loader_block_length; position++) checksum ^= esp32_loader_block[position];
+    esp32_loader_send(ESP32_CMD_FLASH_DEFL_DATA, words, 4, esp32_loader_block, esp32_loader_block_length, checksum, ESP32_LOADER_DATA_TIMEOUT);
+    esp32_loader_block_length = 0;  // Encoded into the frame, the host can fill the next block
+}
+
+static bool esp32_loader_block_ready() {
+    // A full block, or the tail of the stream
+    if (esp32_loader_block_length == ESP32_LOADER_BLOCK_SIZE) return true;
+    return (esp32_loader_block_length > 0) && (esp32_loader_state.received >= esp32_loader_job.compressed_size);
+}
+
+static void esp32_loader_finish(uint8_t error) {
+    esp32_loader_command     = 0;
+    esp32_loader_state.error = error;
+    esp32_loader_state.state = (error == ESP32_LOADER_OK) ? ESP32_LOADER_DONE : ESP32_LOADER_FAILED;
+
+    // Boot the new firmware and hand the UART back to the bridge
+    esp32_reset(false);
+    uart_reapply_line_coding(USB_CDC_ESP32);
+    uart_flow_set(UART_DMA_ESP32, esp32_loader_bridge_flow);
+}
+
+static void esp32_loader_begin() {
+    // The ROM loader erases what it is told to write, round up to whole blocks like esptool does for the ROM
+    uint32_t erase_size      = ((esp32_loader_job.size + ESP32_LOADER_BLOCK_SIZE - 1) / ESP32_LOADER_BLOCK_SIZE) * ESP32_LOADER_BLOCK_SIZE;
+    uint32_t words[4]        = {erase_size, esp32_loader_state.blocks_total, ESP32_LOADER_BLOCK_SIZE, esp32_loader_job.offset};
+    esp32_loader_state.state = ESP32_LOADER_BEGIN;
+    esp32_loader_send(ESP32_CMD_FLASH_DEFL_BEGIN, words, 4, NULL, 0, 0, esp32_loader_timeout_per_mb(ESP32_LOADER_ERASE_US_PER_MB, esp32_loader_job.size));
+}
+
+static void esp32_loader_verify(const uint8_t* digest) {
+    // The ROM answers with the digest as 32 lowercase hex characters
+    static const char hex[] = "0123456789abcdef";
+    for (uint8_t position = 0; position < 16; position++) {
+        if ((digest[position * 2] != hex[esp32_loader_job.md5[position] >> 4]) || (digest[position * 2 + 1] != hex[esp32_loader_job.md5[position] & 0xF])) {
+            esp32_loader_finish(ESP32_LOADER_ERROR_MD5);
+            return;
+        }
+    }
+    esp32_loader_finish(ESP32_LOADER_OK);
+}
+
+static void esp32_loader_handle_response() {
+    uint8_t* response = esp32_loader_response;
+    if ((esp32_loader_response_length < ESP32_LOADER_HEADER_SIZE + 4) || (esp32_loader_response_length > sizeof(esp32_loader_response))) return;
+    uint16_t size = response[2] | (response[3] << 8);
+    if ((response[0] != 0x01) || (response[1] != esp32_loader_command) || (esp32_loader_response_length != ESP32_LOADER_HEADER_SIZE + size)) {
+        return;  // Not the answer we wait for, for example one of the extra responses to a sync
+    }
+
+    // The ROM loader ends every response with four status bytes
+    uint8_t* status = &response[ESP32_LOADER_HEADER_SIZE + size - 4];
+    if (status[0] != 0) {
+        esp32_loader_state.rom_status = status[0];
+        esp32_loader_state.rom_error  = status[1];
+        esp32_loader_finish(ESP32_LOADER_ERROR_REJECTED);
+        return;
+    }
+    esp32_loader_command = 0;
+
+    switch (esp32_loader_state.state) {
+        case ESP32_LOADER_SYNC: {
+            uint32_t words[2]        = {0, 0};  // Default SPI flash pins
+            esp32_loader_state.state = ESP32_LOADER_ATTACH;
+            esp32_loader_send(ESP32_CMD_SPI_ATTACH, words, 2, NULL, 0, 0, ESP32_LOADER_TIMEOUT);
+            break;
+        }
+        case ESP32_LOADER_ATTACH: {
+            uint32_t words[6]        = {0, esp32_loader_job.flash_size, 64 * 1024, 4 * 1024, 256, 0xFFFF};  // Id, size, block, sector, page, status mask
+            esp32_loader_state.state = ESP32_LOADER_PARAMETERS;
+            esp32_loader_send(ESP32_CMD_SPI_SET_PARAMS, words, 6, NULL, 0, 0, ESP32_LOADER_TIMEOUT);
+            break;
+        }
+        case ESP32_LOADER_PARAMETERS:
+            if ((esp32_loader_job.baudrate != 0) && (esp32_loader_job.baudrate != ESP32_LOADER_ROM_BAUDRATE)) {
+                uint32_t words[2]        = {esp32_loader_job.baudrate, 0};  // The old rate is 0 when talking to the ROM
+                esp32_loader_state.state = ESP32_LOADER_BAUDRATE;
+                esp32_loader_send(ESP32_CMD_CHANGE_BAUDRATE, words, 2, NULL, 0, 0, ESP32_LOADER_TIMEOUT);
+            } else {
+                esp32_loader_begin();
+            }
+            break;
+        case ESP32_LOADER_BAUDRATE:
+            // The ROM switches right after its response
+            uart_set_baudrate(UART_ESP32, esp32_loader_job.baudrate);
+            esp32_loader_state.state = ESP32_LOADER_BAUDRATE_SETTLE;
+            esp32_loader_deadline    = time_us_32() + ESP32_LOADER_SETTLE_TIME;
+            break;
+        case ESP32_LOADER_BEGIN:
+            esp32_loader_state.state = ESP32_LOADER_DATA;
+            break;
+        case ESP32_LOADER_DATA:
+            esp32_loader_state.blocks_written++;
+            if (esp32_loader_state.blocks_written >= esp32_loader_state.blocks_total) {
+                uint32_t words[4]        = {esp32_loader_job.offset, esp32_loader_job.size, 0, 0};
+                esp32_loader_state.state = ESP32_LOADER_VERIFY;
+                esp32_loader_send(ESP32_CMD_SPI_FLASH_MD5, words, 4, NULL, 0, 0, esp32_loader_timeout_per_mb(ESP32_LOADER_MD5_US_PER_MB, esp32_loader_job.size));
+            }
+            break;
+        case ESP32_LOADER_VERIFY:
+            if (size < 32 + 4) {
+                esp32_loader_finish(ESP32_LOADER_ERROR_MD5);
+            } else {
+                esp32_loader_verify(&response[ESP32_LOADER_HEADER_SIZE]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void esp32_loader_receive() {
+    const uint8_t* data;
+    uint32_t       length = uart_dma_read_peek(UART_DMA_ESP32, &data);
+    for (uint32_t position = 0; (position < length) && (esp32_loader_command != 0); position++) {
+        uint8_t byte = data[position];
+        if (byte == SLIP_END) {
+            if (esp32_loader_response_length > 0) esp32_loader_handle_response();
+            esp32_loader_response_length = 0;
+            esp32_loader_response_escape = false;
+            continue;
+        }
+        if (esp32_loader_response_escape) {
+            esp32_loader_response_escape = false;
+            if (byte == SLIP_ESC_END) byte = SLIP_END;
+            if (byte == SLIP_ESC_ESC) byte = SLIP_ESC;
+        } else if (byte == SLIP_ESC) {
+            esp32_loader_response_escape = true;
+            continue;
+        }
+        if (esp32_loader_response_length < sizeof(esp32_loader_response)) esp32_loader_response[esp32_loader_response_length] = byte;
+        if (esp32_loader_response_length < UINT16_MAX) esp32_loader_response_length++;
+    }
+    uart_dma_read_advance(UART_DMA_ESP32, length);  // Anything outside a command, like the boot message, is dropped
+}
+
+static void esp32_loader_transmit() {
+    while (esp32_loader_frame_sent < esp32_loader_frame_length) {
+        uint32_t capacity;
+        uint8_t* buffer = uart_dma_write_buffer(UART_DMA_ESP32, &capacity);
+        if (buffer == NULL) return;
+        uint32_t length = esp32_loader_frame_length - esp32_loader_frame_sent;
+        if (length > capacity) length = capacity;
+        memcpy(buffer, &esp32_loader_frame[esp32_loader_frame_sent], length);
+        uart_dma_write_commit(UART_DMA_ESP32, length);
+        esp32_loader_frame_sent += length;
+    }
+}
+
+bool esp32_loader_start(const esp32_loader_start_t* start) {
+    if (esp32_loader_active() || (start->compressed_size == 0)) return false;
+    memcpy(&esp32_loader_job, start, sizeof(esp32_loader_start_t));
+    memset(&esp32_loader_state, 0, sizeof(esp32_loader_status_t));
+    esp32_loader_state.blocks_total = (start->compressed_size + ESP32_LOADER_BLOCK_SIZE - 1) / ESP32_LOADER_BLOCK_SIZE;
+    esp32_loader_block_length       = 0;
+    esp32_loader_frame_length       = 0;
+    esp32_loader_frame_sent         = 0;
+    esp32_loader_command            = 0;
+    esp32_loader_sync_attempts      = 0;
+
+    // Take the UART over from the bridge, the ROM talks 8N1 at its default rate and SLIP is binary
+    esp32_loader_bridge_flow = uart_flow_get(UART_DMA_ESP32);
+    uart_flow_set(UART_DMA_ESP32, UART_FLOW_NONE);
+    uart_set_baudrate(UART_ESP32, ESP32_LOADER_ROM_BAUDRATE);
+    uart_set_format(UART_ESP32, 8, 1, UART_PARITY_NONE);
+
+    esp32_reset(true);
+    esp32_loader_state.state = ESP32_LOADER_RESET;
+    esp32_loader_deadline    = time_us_32() + ESP32_LOADER_BOOT_TIME;
+    return true;
+}
+
+void esp32_loader_abort() {
+    if (esp32_loader_active()) esp32_loader_finish(ESP32_LOADER_ERROR_ABORTED);
+}
+
+bool esp32_loader_active() { return (esp32_loader_state.state != ESP32_LOADER_IDLE) && (esp32_loader_state.state < ESP32_LOADER_DONE); }
+
+const esp32_loader_status_t* esp32_loader_status() { return &esp32_loader_state; }
+
+uint8_t* esp32_loader_buffer(uint32_t* capacity) {
+    *capacity = 0;
+    if (!esp32_loader_active() || (esp32_loader_block_length >= ESP32_LOADER_BLOCK_SIZE)) return NULL;
+    uint32_t remaining = esp32_loader_job.compressed_size - esp32_loader_state.received;
+    if (remaining == 0) return NULL;
+    *capacity = ESP32_LOADER_BLOCK_SIZE - esp32_loader_block_length;
+    if (*capacity > remaining) *capacity = remaining;
+    return &esp32_loader_block[esp32_loader_block_length];
+}
+
+void esp32_loader_commit(uint32_t length) {
+    esp32_loader_block_length   += length;
+    esp32_loader_state.received += length;
+}
+
+void esp32_loader_task() {
+    if (!esp32_loader_active()) return;
+
+    esp32_loader_transmit();
+    esp32_loader_receive();
+    if (!esp32_loader_active()) return;
+
+    bool expired = (int32_t) (time_us_32() - esp32_loader_deadline) >= 0;
+    switch (esp32_loader_state.state) {
+        case ESP32_LOADER_RESET:
+            if (expired) {
+                esp32_loader_state.state = ESP32_LOADER_SYNC;
+                esp32_loader_send_sync();
+            }
+            break;
+        case ESP32_LOADER_SYNC:
+            if ((esp32_loader_command != 0) && expired) {
+                if (++esp32_loader_sync_attempts >= ESP32_LOADER_SYNC_ATTEMPTS) {
+                    esp32_loader_finish(ESP32_LOADER_ERROR_NO_SYNC);
+                } else if (esp32_loader_frame_sent >= esp32_loader_frame_length) {
+                    esp32_loader_send_sync();
+                }
+            }
+            break;
+        case ESP32_LOADER_BAUDRATE_SETTLE:
+            if (expired) {
+                uart_dma_read_advance(UART_DMA_ESP32, uart_dma_read_available(UART_DMA_ESP32));  // Garbage from the switch
+                esp32_loader_begin();
+            }
+            break;
+        case ESP32_LOADER_DATA:
+            if ((esp32_loader_command == 0) && esp32_loader_block_ready()) {
+                esp32_loader_send_block();
+            } else if ((esp32_loader_command != 0) && expired) {
+                esp32_loader_finish(ESP32_LOADER_ERROR_TIMEOUT);
+            }
+            break;
+        default:
+            if ((esp32_loader_command != 0) && expired) esp32_loader_finish(ESP32_LOADER_ERROR_TIMEOUT);
+            break;
+    }
+}
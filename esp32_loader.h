@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Flashes a deflate compressed image streamed by the host through the ESP32 ROM loader, without host round trips per block
+
+enum {
+    ESP32_LOADER_IDLE,
+    ESP32_LOADER_RESET,
+    ESP32_LOADER_SYNC,
+    ESP32_LOADER_ATTACH,
+    ESP32_LOADER_PARAMETERS,
+    ESP32_LOADER_BAUDRATE,
+    ESP32_LOADER_BAUDRATE_SETTLE,
+    ESP32_LOADER_BEGIN,
+    ESP32_LOADER_DATA,
+    ESP32_LOADER_VERIFY,
+    ESP32_LOADER_DONE,
+    ESP32_LOADER_FAILED,
+};
+
+enum {
+    ESP32_LOADER_OK,
+    ESP32_LOADER_ERROR_NO_SYNC,
+    ESP32_LOADER_ERROR_TIMEOUT,
+    ESP32_LOADER_ERROR_REJECTED,  // The ROM answered with a failure status, see rom_status and rom_error
+    ESP32_LOADER_ERROR_MD5,
+    ESP32_LOADER_ERROR_ABORTED,
+};
+
+// Data stage of the start request
+typedef struct __attribute__((packed)) {
+    uint32_t offset;           // Flash address
+    uint32_t size;             // Uncompressed image size
+    uint32_t compressed_size;  // Bytes the host streams over the bulk endpoint
+    uint32_t flash_size;       // In bytes
+    uint32_t baudrate;         // 0 stays at the ROM default of 115200
+    uint8_t  md5[16];          // Of the uncompressed image
+} esp32_loader_start_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  state;
+    uint8_t  error;
+    uint8_t  rom_status;
+    uint8_t  rom_error;
+    uint32_t received;  // Compressed bytes received from the host
+    uint32_t blocks_written;
+    uint32_t blocks_total;
+} esp32_loader_status_t;
+
+bool                         esp32_loader_start(const esp32_loader_start_t* start);
+void                         esp32_loader_abort();
+bool                         esp32_loader_active();  // The loader owns the ESP32 UART, the bridge stays out of the way
+const esp32_loader_status_t* esp32_loader_status();
+void                         esp32_loader_task();
+
+// Host data: fill the returned buffer (for example straight from tud_vendor_n_read()) and commit it
+uint8_t* esp32_loader_buffer(uint32_t* capacity);  // Returns NULL while the next block can't be accepted yet
+void     esp32_loader_commit(uint32_t length);
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "esptool_sniffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLIP_END     0xC0
+#define SLIP_ESC     0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+#define ESPTOOL_DIRECTION_REQUEST  0x00
+#define ESPTOOL_DIRECTION_RESPONSE 0x01
+#define ESPTOOL_CHANGE_BAUDRATE    0x0F
+#define ESPTOOL_HEADER_SIZE        8  // Direction, command, 16-bit size and 32-bit checksum or value
+
+typedef struct {
+    bool     escape;
+    uint16_t length;    // Decoded bytes in the current frame
+    uint8_t  head[16];  // Start of the decoded frame, the header and the first data bytes
+} esptool_slip_t;
+
+static bool           esptool_sniffer_active = true;
+static esptool_slip_t esptool_host_slip;
+static esptool_slip_t esptool_device_slip;
+static uint32_t       esptool_pending_baudrate = 0;  // Requested by the host, waiting for the response
+
+static bool esptool_slip_feed(esptool_slip_t* slip, uint8_t byte) {
+    // Returns true when a frame ended, bytes outside frames (boot messages) end up in short frames that don't match a header
+    if (byte == SLIP_END) {
+        slip->escape = false;
+        return slip->length > 0;
+    }
+    if (slip->escape) {
+        slip->escape = false;
+        if (byte == SLIP_ESC_END) byte = SLIP_END;
+        if (byte == SLIP_ESC_ESC) byte = SLIP_ESC;
+    } else if (byte == SLIP_ESC) {
+        slip->escape = true;
+        return false;
+    }
+    if (slip->length < sizeof(slip->head)) slip->head[slip->length] = byte;
+    if (slip->length < UINT16_MAX) slip->length++;
+    return false;
+}
+
+static bool esptool_frame_is(esptool_slip_t* slip, uint8_t direction, uint16_t minimum_size) {
+    if (slip->length < ESPTOOL_HEADER_SIZE + minimum_size) return false;
+    uint16_t size = slip->head[2] | (slip->head[3] << 8);
+    return (slip->head[0] == direction) && (slip->head[1] == ESPTOOL_CHANGE_BAUDRATE) && (slip->length == ESPTOOL_HEADER_SIZE + size);
+}
+
+void esptool_sniffer_enable(bool enable) {
+    esptool_sniffer_active = enable;
+    esptool_sniffer_reset();
+}
+
+bool esptool_sniffer_enabled() { return esptool_sniffer_active; }
+
+void esptool_sniffer_reset() {
+    memset(&esptool_host_slip, 0, sizeof(esptool_slip_t));
+    memset(&esptool_device_slip, 0, sizeof(esptool_slip_t));
+    esptool_pending_baudrate = 0;
+}
+
+void esptool_sniffer_host(const uint8_t* data, uint32_t length) {
+    if (!esptool_sniffer_active) return;
+    for (uint32_t position = 0; position < length; position++) {
+        if (!esptool_slip_feed(&esptool_host_slip, data[position])) continue;
+        if (esptool_frame_is(&esptool_host_slip, ESPTOOL_DIRECTION_REQUEST, 8)) {
+            // Data is the new baud rate followed by the old one, which is 0 when talking to the ROM
+            uint8_t* baudrate        = &esptool_host_slip.head[ESPTOOL_HEADER_SIZE];
+            esptool_pending_baudrate = baudrate[0] | (baudrate[1] << 8) | (baudrate[2] << 16) | ((uint32_t) baudrate[3] << 24);
+            memset(&esptool_device_slip, 0, sizeof(esptool_slip_t));
+        }
+        esptool_host_slip.length = 0;
+    }
+}
+
+uint32_t esptool_sniffer_device(const uint8_t* data, uint32_t length) {
+    if (!esptool_sniffer_active || (esptool_pending_baudrate == 0)) return 0;
+    for (uint32_t position = 0; position < length; position++) {
+        if (!esptool_slip_feed(&esptool_device_slip, data[position])) continue;
+        bool response              = esptool_frame_is(&esptool_device_slip, ESPTOOL_DIRECTION_RESPONSE, 2);
+        esptool_device_slip.length = 0;
+        if (response) {
+            // The first status byte is 0 on success, the loader switches right after sending the response
+            uint32_t baudrate        = esptool_pending_baudrate;
+            esptool_pending_baudrate = 0;
+            if (esptool_device_slip.head[ESPTOOL_HEADER_SIZE] == 0) return baudrate;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Follows the SLIP framed esptool protocol on the ESP32 port to catch CHANGE_BAUDRATE commands
+void esptool_sniffer_enable(bool enable);
+bool esptool_sniffer_enabled();
+
+void     esptool_sniffer_host(const uint8_t* data, uint32_t length);    // Host to ESP32
+uint32_t esptool_sniffer_device(const uint8_t* data, uint32_t length);  // ESP32 to host, returns the new baud rate once the ROM confirmed it, 0 otherwise
+void     esptool_sniffer_reset();                                       // The ESP32 restarted, forget a pending change
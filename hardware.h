@@ -33,6 +33,9 @@
 #define UART_FPGA_RX_PIN   25
 #define UART_FPGA_BAUDRATE 9600
 
+// System clock for the UART_EXACT_BAUD_CLOCK build option, clk_peri / 16 divides 1, 1.5, 2, 3, 4 and 6 Mbaud exactly
+#define UART_EXACT_BAUD_CLOCK_KHZ 120000
+
 // LCD control lines
 #define LCD_BACKLIGHT_PIN 15
 
@@ -59,6 +62,12 @@
 #define SAO_IO0_PIN 18
 #define SAO_IO1_PIN 19
 
+// Optional UART flow control, active low: SAO_IO0/1 carry the UART0 CTS/RTS functions, the PROTO pins are driven in software for UART1
+#define UART_ESP32_CTS_PIN SAO_IO0_PIN
+#define UART_ESP32_RTS_PIN SAO_IO1_PIN
+#define UART_FPGA_CTS_PIN  PROTO_0_PIN
+#define UART_FPGA_RTS_PIN  PROTO_1_PIN
+
 // IR LED
 #define IR_PIN 27
 #define IR_PIO pio0
@@ -69,4 +78,4 @@
 // USB virtual device numbers
 #define USB_CDC_ESP32 0
 #define USB_CDC_FPGA  1
-#define USB_CDC_STDIO 2
+#define USB_CDC_TRACE 2
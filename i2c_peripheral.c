@@ -10,23 +10,33 @@
 #include <i2c_fifo.h>
 #include <i2c_slave.h>
 #include <pico/stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "RP2040.h"
+#include "analog.h"
+#include "battery.h"
+#include "buttons.h"
 #include "bsp/board.h"
+#include "clock_governor.h"
+#include "crash_record.h"
 #include "hardware.h"
-#include "hardware/adc.h"
+#include "hardware/i2c.h"
 #include "hardware/structs/watchdog.h"
 #include "hardware/watchdog.h"
+#include "ir.h"
 #include "lcd.h"
-#include "nec_transmit.h"
 #include "pico/time.h"
 #include "pico/unique_id.h"
+#include "trace.h"
+#include "uart_flow.h"
 #include "uart_task.h"
 #include "version.h"
 #include "ws2812.h"
 
+static uint32_t i2c_baudrate = 0;
+
 static bool interrupt_target = false;
 static bool interrupt_state  = false;
 static bool interrupt_clear  = false;
@@ -38,7 +48,14 @@ static bool usb_rempote_wakeup_en = false;
 static uint8_t webusb_mode      = 0;
 static bool    webusb_interrupt = false;
 
-static int ir_statemachine = -1;
+static bool button_queue_interrupt = false;  // Interrupt while button events are queued instead of on every input change
+
+static volatile bool ir_done        = false;  // Set when the IR queue drains, cleared when the status register is read
+static volatile bool ir_rx_overflow = false;  // Set when received frames were lost, cleared when the status register is read
+
+static uint32_t crash_record_offset = 0;  // Read position in the crash record streaming window
+
+static uint16_t i2c_status_sequence = 0;
 
 static struct {
     uint8_t registers[256];
@@ -52,8 +69,7 @@ static const uint8_t input1_gpios[]         = {BUTTON_HOME, BUTTON_MENU, BUTTON_
 static const uint8_t input2_gpios[]         = {BUTTON_JOY_A, BUTTON_JOY_B, BUTTON_JOY_C, BUTTON_JOY_D, BUTTON_JOY_E};
 
 static absolute_time_t next_button_poll;
-static absolute_time_t next_adc_read;
-static uint8_t         next_adc_channel;
+static absolute_time_t next_charge_read;
 
 static const bool i2c_registers_read_only[256] = {
     true,  false, true,  false, false, false, true,  true,   // 0-7
@@ -68,11 +84,25 @@ static const bool i2c_registers_read_only[256] = {
     false, false, false, false, false, false, false, false,  // 72-79
     false, false, false, false, false, false, false, false,  // 80-87
     false, false, false, false, false, false, false, false,  // 88-95
-    false, false, false, false, false, false, false, false,  // 96-103
+    false, false, false, false, true,  false, false, false,  // 96-103
     false, false, false, false, false, false, false, false,  // 104-111
     false, false, false, false, false, false, false, false,  // 112-119
     false, false, false, false, false, false, false, false,  // 120-127
-    // ... (128-255)
+    false, false, false, false, false, false, false, false,  // 128-135
+    false, false, false, false, false, false, false, false,  // 136-143
+    false, false, false, false, false, false, false, false,  // 144-151
+    false, true,  true,  false, false, false, false, false,  // 152-159
+    false, false, true,  true,  true,  true,  true,  true,   // 160-167
+    true,  true,  false, false, false, false, false, false,  // 168-175
+    true,  true,  true,  true,  true,  true,  true,  false,  // 176-183
+    false, false, false, false, false, false, false, false,  // 184-191
+    true,  true,  false, true,  false, false, false, false,  // 192-199
+    false, false, false, false, false, false, true,  false,  // 200-207
+    true,  true,  false, false, true,  true,  true,  true,   // 208-215
+    true,  true,  true,  true,  true,  true,  true,  true,   // 216-223
+    true,  true,  true,  true,  true,  true,  true,  true,   // 224-231
+    true,  true,  true,  true,  true,  true,  true,  true,   // 232-239
+    // ... (240-255)
 };
 
 void setup_i2c_peripheral(i2c_inst_t* i2c, uint8_t sda_pin, uint8_t scl_pin, uint8_t address, uint32_t baudrate, i2c_slave_handler_t handler) {
@@ -84,12 +114,12 @@ void setup_i2c_peripheral(i2c_inst_t* i2c, uint8_t sda_pin, uint8_t scl_pin, uin
     gpio_set_function(scl_pin, GPIO_FUNC_I2C);
     gpio_pull_up(scl_pin);
 
+    i2c_baudrate = baudrate;
     i2c_init(i2c, baudrate);
     i2c_slave_init(i2c, address, handler);
 }
 
-void setup_i2c_registers(int param_ir_statemachine) {
-    ir_statemachine = param_ir_statemachine;
+void setup_i2c_registers() {
     for (uint16_t reg = 0; reg < 256; reg++) {
         i2c_registers.registers[reg] = 0;
         i2c_registers.modified[reg]  = false;
@@ -134,12 +164,13 @@ void setup_i2c_registers(int param_ir_statemachine) {
     gpio_set_dir(BATT_CHRG_PIN, false);
     gpio_pull_up(BATT_CHRG_PIN);
 
+    buttons_init();
+    buttons_set_activity_callback(lcd_idle_wake);
     next_button_poll = get_absolute_time();
 
-    next_adc_read    = get_absolute_time();
-    next_adc_channel = 0;
+    next_charge_read = get_absolute_time();
 
-    adc_set_temp_sensor_enabled(true);
+    battery_init();
 }
 
 void i2c_register_write(uint8_t reg, uint8_t value) {
@@ -154,23 +185,76 @@ void __not_in_flash_func(i2c_slave_handler)(i2c_inst_t* i2c, i2c_slave_event_t e
             if (!i2c_registers.write_in_progress) {
                 i2c_registers.address           = i2c_read_byte(i2c);
                 i2c_registers.write_in_progress = true;
+                trace_event(TRACE_EVENT_I2C_ADDRESS, i2c_registers.address, 0);
+                if ((i2c_registers.address == I2C_REGISTER_BUTTON_EVENT_COUNT) || (i2c_registers.address == I2C_REGISTER_BUTTON_EVENT_DATA)) {
+                    buttons_event_restart();  // Start of a burst read, possibly after an aborted one
+                }
+                if ((i2c_registers.address == I2C_REGISTER_CRASH_RECORD_SIZE) || (i2c_registers.address == I2C_REGISTER_CRASH_RECORD_DATA)) {
+                    crash_record_offset = 0;
+                }
+            } else if (i2c_registers.address == I2C_REGISTER_IR_RAW_DATA) {
+                ir_raw_write(i2c_read_byte(i2c));  // Streaming window, the address does not advance
             } else {
                 if (!i2c_registers_read_only[i2c_registers.address]) {
                     i2c_registers.registers[i2c_registers.address] = i2c_read_byte(i2c);
                     i2c_registers.modified[i2c_registers.address]  = true;
+                    trace_event(TRACE_EVENT_I2C_WRITE, i2c_registers.address, i2c_registers.registers[i2c_registers.address]);
                 }
                 i2c_registers.address++;
             }
             break;
         case I2C_SLAVE_REQUEST:
             i2c_registers.write_in_progress = false;
+            if (i2c_registers.address == I2C_REGISTER_IR_RX_RAW_DATA) {
+                i2c_write_byte(i2c, ir_rx_raw_read());  // Streaming window, the address does not advance
+                break;
+            }
+            if (i2c_registers.address == I2C_REGISTER_BUTTON_EVENT_DATA) {
+                i2c_write_byte(i2c, buttons_event_read());  // Streaming window, the address does not advance
+                break;
+            }
+            if (i2c_registers.address == I2C_REGISTER_CRASH_RECORD_DATA) {
+                const crash_record_t* record = crash_record_get();
+                uint8_t               value  = 0;
+                if ((record != NULL) && (crash_record_offset < sizeof(crash_record_t))) value = ((const uint8_t*) record)[crash_record_offset++];
+                i2c_write_byte(i2c, value);  // Streaming window, the address does not advance
+                break;
+            }
+            if (i2c_registers.address == I2C_REGISTER_CRASH_RECORD_SIZE) {
+                i2c_registers.registers[I2C_REGISTER_CRASH_RECORD_SIZE] = (crash_record_get() != NULL) ? sizeof(crash_record_t) : 0;
+            }
+            if (i2c_registers.address == I2C_REGISTER_BUTTON_EVENT_COUNT) {
+                i2c_registers.registers[I2C_REGISTER_BUTTON_EVENT_COUNT] = buttons_event_count();  // Match the events that follow in the same burst
+            }
             i2c_write_byte(i2c, i2c_registers.registers[i2c_registers.address]);
+            trace_event(TRACE_EVENT_I2C_READ, i2c_registers.address, i2c_registers.registers[i2c_registers.address]);
             if (i2c_registers.address == I2C_REGISTER_INTERRUPT2) {
                 interrupt_target                                 = false;
                 interrupt_clear                                  = true;
                 i2c_registers.registers[I2C_REGISTER_INTERRUPT1] = 0;
                 i2c_registers.registers[I2C_REGISTER_INTERRUPT2] = 0;
             }
+            if (i2c_registers.address == I2C_REGISTER_STATUS0 + offsetof(i2c_status_t, interrupt2)) {
+                // The block can be older than the live flags, only clear what it reported and raise the line again for the rest
+                i2c_registers.registers[I2C_REGISTER_INTERRUPT1] &= ~i2c_registers.registers[I2C_REGISTER_STATUS0 + offsetof(i2c_status_t, interrupt1)];
+                i2c_registers.registers[I2C_REGISTER_INTERRUPT2] &= ~i2c_registers.registers[I2C_REGISTER_STATUS0 + offsetof(i2c_status_t, interrupt2)];
+                interrupt_target = i2c_registers.registers[I2C_REGISTER_INTERRUPT1] || i2c_registers.registers[I2C_REGISTER_INTERRUPT2];
+                interrupt_clear  = true;
+            }
+            if (i2c_registers.address == I2C_REGISTER_IR_STATUS) {
+                ir_done = false;
+                i2c_registers.registers[I2C_REGISTER_IR_STATUS] &= ~0x04;
+            }
+            if (i2c_registers.address == I2C_REGISTER_BUTTON_STATUS) {
+                i2c_registers.registers[I2C_REGISTER_BUTTON_STATUS] &= ~0x01;
+            }
+            if (i2c_registers.address == I2C_REGISTER_BATTERY_EVENTS) {
+                i2c_registers.registers[I2C_REGISTER_BATTERY_EVENTS] = 0;
+            }
+            if (i2c_registers.address == I2C_REGISTER_IR_RX_STATUS) {
+                ir_rx_overflow = false;
+                i2c_registers.registers[I2C_REGISTER_IR_RX_STATUS] &= ~0x02;
+            }
             i2c_registers.address++;
             break;
         case I2C_SLAVE_FINISH:
@@ -181,17 +265,49 @@ void __not_in_flash_func(i2c_slave_handler)(i2c_inst_t* i2c, i2c_slave_event_t e
     }
 }
 
+static void i2c_status_refresh() {
+    i2c_status_t status;
+    memset(&status, 0, sizeof(status));
+    status.version        = I2C_STATUS_VERSION;
+    status.size           = sizeof(i2c_status_t);
+    status.input1         = i2c_registers.registers[I2C_REGISTER_INPUT1];
+    status.input2         = i2c_registers.registers[I2C_REGISTER_INPUT2];
+    status.interrupt1     = i2c_registers.registers[I2C_REGISTER_INTERRUPT1];
+    status.interrupt2     = i2c_registers.registers[I2C_REGISTER_INTERRUPT2];
+    status.adc_vusb       = i2c_registers.registers[I2C_REGISTER_ADC_VALUE_VUSB_LO] | (i2c_registers.registers[I2C_REGISTER_ADC_VALUE_VUSB_HI] << 8);
+    status.adc_vbat       = i2c_registers.registers[I2C_REGISTER_ADC_VALUE_VBAT_LO] | (i2c_registers.registers[I2C_REGISTER_ADC_VALUE_VBAT_HI] << 8);
+    status.adc_temp       = i2c_registers.registers[I2C_REGISTER_ADC_VALUE_TEMP_LO] | (i2c_registers.registers[I2C_REGISTER_ADC_VALUE_TEMP_HI] << 8);
+    status.usb            = i2c_registers.registers[I2C_REGISTER_USB];
+    status.charging_state = i2c_registers.registers[I2C_REGISTER_CHARGING_STATE];
+    status.webusb_mode    = i2c_registers.registers[I2C_REGISTER_WEBUSB_MODE];
+
+    uint8_t* block = &i2c_registers.registers[I2C_REGISTER_STATUS0];
+    size_t   start = offsetof(i2c_status_t, input1);  // Uptime changes on every refresh, only the fields after it count as a change
+
+    // A transfer can start at any time, check for one with interrupts disabled so a burst read never sees half a refresh
+    uint32_t state = save_and_disable_interrupts();
+    if (i2c_idle()) {
+        if (memcmp(block + start, ((uint8_t*) &status) + start, sizeof(i2c_status_t) - start) != 0) i2c_status_sequence++;
+        status.sequence  = i2c_status_sequence;
+        status.uptime_ms = to_ms_since_boot(get_absolute_time());
+        memcpy(block, &status, sizeof(i2c_status_t));
+    }
+    restore_interrupts(state);
+}
+
 #define BOOTLOADER_ENTRY_MAGIC 0xb105f00d
 
 void i2c_handle_register_write(uint8_t reg, uint8_t value) {
     switch (reg) {
         case I2C_REGISTER_GPIO_DIR:
             for (uint8_t pin = 0; pin < sizeof(i2c_controlled_gpios); pin++) {
+                if (uart_flow_owns_pin(i2c_controlled_gpios[pin])) continue;  // CTS and RTS stay with the UART bridge
                 gpio_set_dir(i2c_controlled_gpios[pin], (value & (1 << pin)) >> pin);
             }
             break;
         case I2C_REGISTER_GPIO_OUT:
             for (uint8_t pin = 0; pin < sizeof(i2c_controlled_gpios); pin++) {
+                if (uart_flow_owns_pin(i2c_controlled_gpios[pin])) continue;
                 gpio_put(i2c_controlled_gpios[pin], (value & (1 << pin)) >> pin);
             }
             break;
@@ -202,12 +318,20 @@ void i2c_handle_register_write(uint8_t reg, uint8_t value) {
         case I2C_REGISTER_LCD_BACKLIGHT:
             lcd_backlight(value);
             break;
+        case I2C_REGISTER_LCD_IDLE_DIM_TIMEOUT:
+        case I2C_REGISTER_LCD_IDLE_OFF_TIMEOUT:
+        case I2C_REGISTER_LCD_IDLE_DIM_LEVEL:
+            lcd_idle_configure(i2c_registers.registers[I2C_REGISTER_LCD_IDLE_DIM_TIMEOUT], i2c_registers.registers[I2C_REGISTER_LCD_IDLE_OFF_TIMEOUT],
+                               i2c_registers.registers[I2C_REGISTER_LCD_IDLE_DIM_LEVEL]);
+            break;
+        case I2C_REGISTER_LCD_BACKLIGHT_FADE:
+        case I2C_REGISTER_LCD_BACKLIGHT_CONFIG:
+            lcd_backlight_configure(i2c_registers.registers[I2C_REGISTER_LCD_BACKLIGHT_FADE] * 10, i2c_registers.registers[I2C_REGISTER_LCD_BACKLIGHT_CONFIG] & 0x01);
+            break;
         case I2C_REGISTER_ADC_TRIGGER:
+            analog_set_on_demand(value & 0x02);
             if (value & 0x01) {
-                // To-do: read ADC
-            }
-            if (value & 0x02) {
-                // To-do: read ADC
+                analog_trigger();
             }
             break;
         case I2C_REGISTER_BL_TRIGGER:
@@ -223,12 +347,63 @@ void i2c_handle_register_write(uint8_t reg, uint8_t value) {
             }
             break;
         case I2C_REGISTER_IR_TRIGGER:
-            if (value == 0x01) {
+            if ((value == 0x01) || (value == 0x03)) {  // Send frame, 0x03 keeps sending repeat codes afterwards
                 uint16_t address = i2c_registers.registers[I2C_REGISTER_IR_ADDRESS_LO] + (i2c_registers.registers[I2C_REGISTER_IR_ADDRESS_HI] << 8);
-                uint16_t command = i2c_registers.registers[I2C_REGISTER_IR_COMMAND] + ((~i2c_registers.registers[I2C_REGISTER_IR_COMMAND]) << 8);
-                nec_tx_extended(IR_PIO, ir_statemachine, address, command);
+                ir_queue_frame(i2c_registers.registers[I2C_REGISTER_IR_PROTOCOL], address, i2c_registers.registers[I2C_REGISTER_IR_COMMAND]);
+                ir_set_repeating(value == 0x03);
+            } else if (value == 0x02) {  // Send a single repeat code
+                ir_queue_repeat();
+            } else if (value == 0x04) {  // Stop sending repeat codes
+                ir_set_repeating(false);
+            } else if (value == 0x05) {  // Play the raw buffer
+                ir_queue_raw();
+            } else if (value == 0x06) {  // Clear the raw buffer
+                ir_raw_clear();
+            }
+            break;
+        case I2C_REGISTER_IR_CARRIER:
+        case I2C_REGISTER_IR_DUTY:
+            ir_set_carrier(i2c_registers.registers[I2C_REGISTER_IR_CARRIER] * 1000, i2c_registers.registers[I2C_REGISTER_IR_DUTY]);
+            break;
+        case I2C_REGISTER_IR_RX_CONFIG:
+            if (!ir_rx_configure(value & 0x01, i2c_controlled_gpios[(value >> 1) & 0x03], value & 0x08)) {
+                i2c_registers.registers[I2C_REGISTER_IR_RX_CONFIG] &= ~0x01;  // Reads back as disabled when the pin is taken by flow control
+            }
+            break;
+        case I2C_REGISTER_IR_RX_STATUS:
+            if (value & 0x01) {  // Done with the current frame, load the next one
+                ir_rx_pop();
+                if (ir_rx_frame() != NULL) interrupt_target = true;
             }
             break;
+        case I2C_REGISTER_BATTERY_THRESHOLD_LOW:
+        case I2C_REGISTER_BATTERY_THRESHOLD_HIGH:
+            battery_set_thresholds(i2c_registers.registers[I2C_REGISTER_BATTERY_THRESHOLD_LOW], i2c_registers.registers[I2C_REGISTER_BATTERY_THRESHOLD_HIGH]);
+            break;
+        case I2C_REGISTER_BATTERY_CAL_VBAT_OFFSET:
+        case I2C_REGISTER_BATTERY_CAL_VBAT_GAIN:
+        case I2C_REGISTER_BATTERY_CAL_VUSB_OFFSET:
+        case I2C_REGISTER_BATTERY_CAL_VUSB_GAIN:
+            battery_set_calibration(i2c_registers.registers[I2C_REGISTER_BATTERY_CAL_VBAT_OFFSET], i2c_registers.registers[I2C_REGISTER_BATTERY_CAL_VBAT_GAIN],
+                                    i2c_registers.registers[I2C_REGISTER_BATTERY_CAL_VUSB_OFFSET], i2c_registers.registers[I2C_REGISTER_BATTERY_CAL_VUSB_GAIN]);
+            break;
+        case I2C_REGISTER_CRASH_RECORD_CLEAR:
+            if (value == 0x01) crash_record_clear();
+            break;
+        case I2C_REGISTER_CLOCK_CONFIG:
+            clock_governor_set_enabled(!(value & 0x01));
+            clock_governor_reset_residency();
+            break;
+        case I2C_REGISTER_BUTTON_DEBOUNCE:
+            buttons_set_debounce(value);
+            break;
+        case I2C_REGISTER_BUTTON_CONFIG:
+            button_queue_interrupt = value & 0x01;
+            break;
+        case I2C_REGISTER_BUTTON_LONG_PRESS:
+        case I2C_REGISTER_BUTTON_REPEAT:
+            buttons_set_hold(i2c_registers.registers[I2C_REGISTER_BUTTON_LONG_PRESS] * 10, i2c_registers.registers[I2C_REGISTER_BUTTON_REPEAT] * 10);
+            break;
         case I2C_REGISTER_WS2812_MODE:
             switch (value) {
                 case 0x01:  // 24-bit (RGB) mode
@@ -245,6 +420,7 @@ void i2c_handle_register_write(uint8_t reg, uint8_t value) {
             {
                 uint8_t length = i2c_registers.registers[I2C_REGISTER_WS2812_LENGTH];
                 if (length > 10) length = 10;
+                clock_governor_demand();  // Animations write the LEDs in quick succession, stay boosted while they run
                 for (uint8_t i = 0; i < length; i++) {
                     uint32_t* value = (uint32_t*) &i2c_registers.registers[I2C_REGISTER_WS2812_LED0_DATA0 + (i * 4)];
                     ws2812_put(*value);
@@ -259,14 +435,15 @@ void i2c_handle_register_write(uint8_t reg, uint8_t value) {
 void i2c_task() {
     bool busy = i2c_slave_transfer_in_progress(I2C_SYSTEM);
     if (!busy) {
-        // Deal with IRQ first
+        // Deal with IRQ first, in queue mode button events keep the interrupt asserted until the queue is drained
+        bool interrupt_wanted = interrupt_target || (button_queue_interrupt && buttons_event_count());
         if (interrupt_clear) {
             gpio_set_dir(ESP32_INT_PIN, false);  // Input, pin has pull-up, idle state
             interrupt_state = false;
             interrupt_clear = false;
-        } else if (interrupt_target != interrupt_state) {
-            interrupt_state = interrupt_target;
-            if (interrupt_target) {
+        } else if (interrupt_wanted != interrupt_state) {
+            interrupt_state = interrupt_wanted;
+            if (interrupt_wanted) {
                 gpio_set_dir(ESP32_INT_PIN, true);  // Output, low, trigger interrupt on ESP32
                 gpio_put(ESP32_INT_PIN, false);
             } else {
@@ -285,6 +462,10 @@ void i2c_task() {
         // Set USB state register
         i2c_registers.registers[I2C_REGISTER_USB] = (usb_mounted & 1) | ((usb_suspended & 1) << 1) | ((usb_rempote_wakeup_en & 1) << 2);
 
+        // Backlight idle policy
+        if ((i2c_registers.registers[I2C_REGISTER_LCD_IDLE_CONFIG] & 0x01) && usb_mounted) lcd_idle_wake();
+        i2c_registers.registers[I2C_REGISTER_LCD_IDLE_STATE] = lcd_idle_task();
+
         // Set WebUSB mode register
         i2c_registers.registers[I2C_REGISTER_WEBUSB_MODE] = webusb_mode;
         if (webusb_interrupt) {
@@ -292,6 +473,31 @@ void i2c_task() {
             interrupt_target = true;
         }
 
+        // Set IR status register
+        if (ir_task()) {
+            ir_done          = true;
+            interrupt_target = true;
+        }
+        i2c_registers.registers[I2C_REGISTER_IR_STATUS] =
+            (ir_busy() & 1) | ((ir_queue_full() & 1) << 1) | ((ir_done & 1) << 2) | ((ir_raw_full() & 1) << 3);
+        uint16_t* reg_ir_raw_count = (uint16_t*) &i2c_registers.registers[I2C_REGISTER_IR_RAW_COUNT_LO];
+        *reg_ir_raw_count          = ir_raw_count();
+
+        // Set IR receiver registers
+        if (ir_rx_task()) {
+            interrupt_target = true;
+        }
+        ir_decode_frame_t* ir_frame = ir_rx_frame();
+        if (ir_rx_overflowed()) ir_rx_overflow = true;
+        i2c_registers.registers[I2C_REGISTER_IR_RX_STATUS]     = ((ir_frame != NULL) & 1) | ((ir_rx_overflow & 1) << 1);
+        i2c_registers.registers[I2C_REGISTER_IR_RX_PROTOCOL]   = ir_frame ? ir_frame->protocol : 0;
+        i2c_registers.registers[I2C_REGISTER_IR_RX_FLAGS]      = ir_frame ? ir_frame->repeat : 0;
+        i2c_registers.registers[I2C_REGISTER_IR_RX_ADDRESS_LO] = ir_frame ? (ir_frame->address & 0xFF) : 0;
+        i2c_registers.registers[I2C_REGISTER_IR_RX_ADDRESS_HI] = ir_frame ? (ir_frame->address >> 8) : 0;
+        i2c_registers.registers[I2C_REGISTER_IR_RX_COMMAND_LO] = ir_frame ? (ir_frame->command & 0xFF) : 0;
+        i2c_registers.registers[I2C_REGISTER_IR_RX_COMMAND_HI] = ir_frame ? (ir_frame->command >> 8) : 0;
+        i2c_registers.registers[I2C_REGISTER_IR_RX_RAW_COUNT]  = ir_frame ? ir_frame->raw_length : 0;
+
         // Read GPIO pins
         uint8_t gpio_in_value = 0;
         for (uint8_t index = 0; index < sizeof(i2c_controlled_gpios); index++) {
@@ -300,6 +506,20 @@ void i2c_task() {
 
         absolute_time_t now = get_absolute_time();
 
+        // Buttons are debounced in the background, changes are reported even when a button changed back since the last pass
+        uint16_t buttons_changed = buttons_changes();
+        uint16_t buttons_level   = buttons_state();
+        if (buttons_changed) {
+            if (!button_queue_interrupt) interrupt_target = true;
+            i2c_registers.registers[I2C_REGISTER_INTERRUPT1] |= buttons_changed & 0xFF;
+            i2c_registers.registers[I2C_REGISTER_INTERRUPT2] |= buttons_changed >> 8;
+        }
+        i2c_registers.registers[I2C_REGISTER_INPUT1] = (i2c_registers.registers[I2C_REGISTER_INPUT1] & (1 << 5)) | (buttons_level & 0x9F);
+        i2c_registers.registers[I2C_REGISTER_INPUT2] = buttons_level >> 8;
+
+        if (buttons_overflowed()) i2c_registers.registers[I2C_REGISTER_BUTTON_STATUS] |= 0x01;
+        i2c_registers.registers[I2C_REGISTER_BUTTON_EVENT_COUNT] = buttons_event_count();
+
 #ifdef NDEBUG
         if (now > next_button_poll) {
 #else
@@ -307,23 +527,15 @@ void i2c_task() {
 #endif
             next_button_poll = delayed_by_ms(now, 30);
 
-            // Read inputs
-            uint8_t input1_value = 0;
-            for (uint8_t index = 0; index < sizeof(input1_gpios); index++) {
-                input1_value |= (!gpio_get(input1_gpios[index])) << index;
-            }
-            input1_value |= board_button_read() << 7;  // Select button
-            if (input1_value != i2c_registers.registers[I2C_REGISTER_INPUT1]) interrupt_target = true;
-            i2c_registers.registers[I2C_REGISTER_INTERRUPT1] |= (input1_value ^ i2c_registers.registers[I2C_REGISTER_INPUT1]);
-            i2c_registers.registers[I2C_REGISTER_INPUT1] = input1_value;
-
-            uint8_t input2_value = 0;
-            for (uint8_t index = 0; index < sizeof(input2_gpios); index++) {
-                input2_value |= (!gpio_get(input2_gpios[index])) << index;
+            // The SELECT button shares the flash chip select and can only be polled
+            buttons_set_polled(7, board_button_read());
+
+            uint8_t cdone_value = (!gpio_get(FPGA_CDONE)) << 5;
+            if (cdone_value != (i2c_registers.registers[I2C_REGISTER_INPUT1] & (1 << 5))) {
+                interrupt_target = true;
+                i2c_registers.registers[I2C_REGISTER_INTERRUPT1] |= 1 << 5;
             }
-            if (input2_value != i2c_registers.registers[I2C_REGISTER_INPUT2]) interrupt_target = true;
-            i2c_registers.registers[I2C_REGISTER_INTERRUPT2] |= (input2_value ^ i2c_registers.registers[I2C_REGISTER_INPUT2]);
-            i2c_registers.registers[I2C_REGISTER_INPUT2] = input2_value;
+            i2c_registers.registers[I2C_REGISTER_INPUT1] = (i2c_registers.registers[I2C_REGISTER_INPUT1] & ~(1 << 5)) | cdone_value;
         } else {
             // The CDONE pin is part of the input register but should not be polled slowly, so if we're not polling the other buttons just read the FPGA cdone pin and update the register
             if (!gpio_get(FPGA_CDONE)) {
@@ -334,45 +546,64 @@ void i2c_task() {
         }
 
 #ifdef NDEBUG
-        if (now > next_adc_read) {  // Once every 250ms
+        if (now > next_charge_read) {  // Once every 250ms
 #else
-        if (now._private_us_since_boot > next_adc_read._private_us_since_boot) {  // Once every 250ms
+        if (now._private_us_since_boot > next_charge_read._private_us_since_boot) {  // Once every 250ms
 #endif
-            next_adc_read = delayed_by_ms(now, 250);
-
-            i2c_registers.registers[I2C_REGISTER_CHARGING_STATE] = !gpio_get(BATT_CHRG_PIN);
-
-            switch (next_adc_channel) {
-                case 0:
-                    {
-                        uint16_t* reg_vusb = (uint16_t*) &i2c_registers.registers[I2C_REGISTER_ADC_VALUE_VUSB_LO];
-                        adc_select_input(ANALOG_VUSB_ADC);
-                        *reg_vusb        = adc_read();
-                        next_adc_channel = 1;
-                        break;
-                    }
-                case 1:
-                    {
-                        uint16_t* reg_vbat = (uint16_t*) &i2c_registers.registers[I2C_REGISTER_ADC_VALUE_VBAT_LO];
-                        adc_select_input(ANALOG_VBAT_ADC);
-                        *reg_vbat        = adc_read();
-                        next_adc_channel = 2;
-                        break;
-                    }
-                case 2:
-                default:
-                    {
-                        uint16_t* reg_temp = (uint16_t*) &i2c_registers.registers[I2C_REGISTER_ADC_VALUE_TEMP_LO];
-                        adc_select_input(ANALOG_TEMP_ADC);
-                        *reg_temp        = adc_read();
-                        next_adc_channel = 0;
-                        break;
-                    }
+            next_charge_read = delayed_by_ms(now, 250);
+
+            bool charging                                        = !gpio_get(BATT_CHRG_PIN);
+            i2c_registers.registers[I2C_REGISTER_CHARGING_STATE] = charging;
+
+            // The estimator starts from its first sample, wait for the first ADC block instead of feeding it zeros
+            if (analog_ready()) {
+                uint8_t battery_events = battery_task(analog_vbat(), analog_vusb(), charging);
+                i2c_registers.registers[I2C_REGISTER_BATTERY_EVENTS] |= battery_events;
+                if (battery_events & (BATTERY_EVENT_LOW | BATTERY_EVENT_HIGH)) interrupt_target = true;  // Charge state changes don't interrupt
+                uint16_t* reg_battery_vbat                          = (uint16_t*) &i2c_registers.registers[I2C_REGISTER_BATTERY_VBAT_LO];
+                uint16_t* reg_battery_vusb                          = (uint16_t*) &i2c_registers.registers[I2C_REGISTER_BATTERY_VUSB_LO];
+                *reg_battery_vbat                                   = battery_vbat_mv();
+                *reg_battery_vusb                                   = battery_vusb_mv();
+                i2c_registers.registers[I2C_REGISTER_BATTERY_SOC]   = battery_soc();
+                i2c_registers.registers[I2C_REGISTER_BATTERY_STATE] = battery_state();
             }
+
+            i2c_registers.registers[I2C_REGISTER_CLOCK_RESIDENCY_BOOST]  = clock_governor_residency(CLOCK_LEVEL_BOOST);
+            i2c_registers.registers[I2C_REGISTER_CLOCK_RESIDENCY_NORMAL] = clock_governor_residency(CLOCK_LEVEL_NORMAL);
+            i2c_registers.registers[I2C_REGISTER_CLOCK_RESIDENCY_IDLE]   = clock_governor_residency(CLOCK_LEVEL_IDLE);
         }
+
+        // Filtered ADC values, kept up to date by DMA
+        uint16_t* reg_vusb = (uint16_t*) &i2c_registers.registers[I2C_REGISTER_ADC_VALUE_VUSB_LO];
+        uint16_t* reg_vbat = (uint16_t*) &i2c_registers.registers[I2C_REGISTER_ADC_VALUE_VBAT_LO];
+        uint16_t* reg_temp = (uint16_t*) &i2c_registers.registers[I2C_REGISTER_ADC_VALUE_TEMP_LO];
+        *reg_vusb          = analog_vusb();
+        *reg_vbat          = analog_vbat();
+        *reg_temp          = analog_temperature();
+
+        // Busy bit of the trigger register, a trigger written by the I2C interrupt handler is kept until it has been dispatched
+        uint32_t state = save_and_disable_interrupts();
+        if (!i2c_registers.modified[I2C_REGISTER_ADC_TRIGGER]) {
+            i2c_registers.registers[I2C_REGISTER_ADC_TRIGGER] = (i2c_registers.registers[I2C_REGISTER_ADC_TRIGGER] & 0x02) | (analog_busy() & 1);
+        }
+        restore_interrupts(state);
+
+        // Clock governor, runs from here so a level change only retimes the bus between transfers
+        clock_governor_task();
+        i2c_registers.registers[I2C_REGISTER_CLOCK_CONFIG] = !clock_governor_enabled();
+        i2c_registers.registers[I2C_REGISTER_CLOCK_MHZ]    = clock_governor_hz() / 1000000;
+
+        // Mirror everything above into the status block last
+        i2c_status_refresh();
     }
 }
 
+bool i2c_idle() { return !i2c_slave_transfer_in_progress(I2C_SYSTEM) && !(i2c_get_hw(I2C_SYSTEM)->status & I2C_IC_STATUS_SLV_ACTIVITY_BITS); }
+
+void i2c_clock_changed() {
+    if (i2c_baudrate) i2c_set_baudrate(I2C_SYSTEM, i2c_baudrate);  // Rewrites the SCL counts and the SDA hold time, disables the block briefly
+}
+
 void i2c_usb_set_mounted(bool mounted) { usb_mounted = mounted; }
 
 void i2c_usb_set_suspended(bool suspended, bool remote_wakeup_en) {
@@ -7,10 +7,12 @@
 
 void setup_i2c_peripheral(i2c_inst_t *i2c, uint8_t sda_pin, uint8_t scl_pin, uint8_t address, uint32_t baudrate, i2c_slave_handler_t handler);
 
-void setup_i2c_registers(int param_ir_statemachine);
+void setup_i2c_registers();
 
 void i2c_slave_handler(i2c_inst_t *i2c, i2c_slave_event_t event);
 void i2c_task();
+bool i2c_idle();           // No transfer in progress, the bus timing can be changed
+void i2c_clock_changed();  // Recalculates the bus timing after a system clock change
 
 void i2c_register_write(uint8_t reg, uint8_t value);
 
@@ -38,7 +40,7 @@ enum {
     // 8-15
     I2C_REGISTER_INTERRUPT1,
     I2C_REGISTER_INTERRUPT2,
-    I2C_REGISTER_ADC_TRIGGER,
+    I2C_REGISTER_ADC_TRIGGER,  // Bit 0: start a burst capture (reads 1 until done), bit 1: on-demand mode, stop free-running conversions
     I2C_REGISTER_ADC_VALUE_VUSB_LO,
     I2C_REGISTER_ADC_VALUE_VUSB_HI,
     I2C_REGISTER_ADC_VALUE_VBAT_LO,
@@ -150,10 +152,10 @@ enum {
     I2C_REGISTER_IR_ADDRESS_HI,
     I2C_REGISTER_IR_COMMAND,
     I2C_REGISTER_IR_TRIGGER,
-    I2C_REGISTER_RESERVED11,
-    I2C_REGISTER_RESERVED12,
-    I2C_REGISTER_RESERVED13,
-    I2C_REGISTER_RESERVED14,
+    I2C_REGISTER_IR_STATUS,    // Bit 0: busy, bit 1: queue full, bit 2: queue drained (cleared on read), bit 3: raw buffer full
+    I2C_REGISTER_IR_PROTOCOL,  // 0: NEC, 1: RC5, 2: RC6, 3: SIRC 12-bit, 4: SIRC 15-bit, 5: SIRC 20-bit
+    I2C_REGISTER_IR_CARRIER,   // Carrier frequency in kHz, 0 for the protocol default
+    I2C_REGISTER_IR_DUTY,      // Carrier duty cycle in percent, 0 for the default of 33%
 
     // 104-111
     I2C_REGISTER_WS2812_MODE,
@@ -205,7 +207,7 @@ enum {
     I2C_REGISTER_WS2812_LED8_DATA2,
     I2C_REGISTER_WS2812_LED8_DATA3,
 
-    // 136-143
+    // 144-151
     I2C_REGISTER_WS2812_LED9_DATA0,
     I2C_REGISTER_WS2812_LED9_DATA1,
     I2C_REGISTER_WS2812_LED9_DATA2,
@@ -215,5 +217,136 @@ enum {
     I2C_REGISTER_RESERVED25,
     I2C_REGISTER_RESERVED26,
 
-    // ... (128-255)
+    // 152-159
+    I2C_REGISTER_IR_RAW_DATA,      // Streaming window: little endian 16-bit mark and space lengths in microseconds
+    I2C_REGISTER_IR_RAW_COUNT_LO,  // Number of complete mark/space pairs in the raw buffer
+    I2C_REGISTER_IR_RAW_COUNT_HI,
+    I2C_REGISTER_RESERVED27,
+    I2C_REGISTER_RESERVED28,
+    I2C_REGISTER_RESERVED29,
+    I2C_REGISTER_RESERVED30,
+    I2C_REGISTER_RESERVED31,
+
+    // 160-167
+    I2C_REGISTER_IR_RX_CONFIG,      // Bit 0: enable, bits 1-2: input pin (SAO IO0, SAO IO1, PROTO 0, PROTO 1), bit 3: active high receiver
+    I2C_REGISTER_IR_RX_STATUS,      // Bit 0: frame available, bit 1: frames lost (cleared on read), write 1 to bit 0 to load the next frame
+    I2C_REGISTER_IR_RX_PROTOCOL,    // 0: NEC, 6: raw timings
+    I2C_REGISTER_IR_RX_FLAGS,       // Bit 0: repeat code
+    I2C_REGISTER_IR_RX_ADDRESS_LO,
+    I2C_REGISTER_IR_RX_ADDRESS_HI,
+    I2C_REGISTER_IR_RX_COMMAND_LO,
+    I2C_REGISTER_IR_RX_COMMAND_HI,
+
+    // 168-175
+    I2C_REGISTER_IR_RX_RAW_COUNT,  // Number of mark and space lengths in the current frame
+    I2C_REGISTER_IR_RX_RAW_DATA,   // Streaming window: little endian 16-bit lengths in microseconds, starting with a mark
+    I2C_REGISTER_RESERVED32,
+    I2C_REGISTER_RESERVED33,
+    I2C_REGISTER_RESERVED34,
+    I2C_REGISTER_RESERVED35,
+    I2C_REGISTER_RESERVED36,
+    I2C_REGISTER_RESERVED37,
+
+    // 176-183
+    I2C_REGISTER_BATTERY_VBAT_LO,  // Calibrated battery voltage in mV
+    I2C_REGISTER_BATTERY_VBAT_HI,
+    I2C_REGISTER_BATTERY_VUSB_LO,  // Calibrated USB voltage in mV
+    I2C_REGISTER_BATTERY_VUSB_HI,
+    I2C_REGISTER_BATTERY_SOC,            // Smoothed state of charge in percent
+    I2C_REGISTER_BATTERY_STATE,          // 0: discharging, 1: charging, 2: charged
+    I2C_REGISTER_BATTERY_EVENTS,         // Bit 0: charge state changed (no interrupt), bit 1: low threshold, bit 2: high threshold (cleared on read)
+    I2C_REGISTER_BATTERY_THRESHOLD_LOW,  // In percent, 0 disables
+
+    // 184-191
+    I2C_REGISTER_BATTERY_THRESHOLD_HIGH,   // In percent, 0 disables
+    I2C_REGISTER_BATTERY_CAL_VBAT_OFFSET,  // Signed, in mV
+    I2C_REGISTER_BATTERY_CAL_VBAT_GAIN,    // Signed, in 0.1% steps
+    I2C_REGISTER_BATTERY_CAL_VUSB_OFFSET,
+    I2C_REGISTER_BATTERY_CAL_VUSB_GAIN,
+    I2C_REGISTER_RESERVED38,
+    I2C_REGISTER_RESERVED39,
+    I2C_REGISTER_RESERVED40,
+
+    // 192-199
+    I2C_REGISTER_BUTTON_EVENT_COUNT,  // Number of queued button events, a burst read starting here continues with the events
+    I2C_REGISTER_BUTTON_EVENT_DATA,   // Streaming window: 6 bytes per event (button, type, 32-bit timestamp in ms), an event is removed after its last byte
+    I2C_REGISTER_BUTTON_DEBOUNCE,     // Milliseconds a button has to be stable before a new level is accepted, 0 for the default of 5
+    I2C_REGISTER_BUTTON_STATUS,       // Bit 0: events were lost (cleared on read)
+    I2C_REGISTER_BUTTON_CONFIG,       // Bit 0: assert the interrupt only while events are queued instead of on input changes
+    I2C_REGISTER_BUTTON_LONG_PRESS,   // Hold time before a long press event in 10 ms steps, 0 disables
+    I2C_REGISTER_BUTTON_REPEAT,       // Interval of repeat events while held in 10 ms steps, 0 disables
+    I2C_REGISTER_RESERVED41,
+
+    // 200-207
+    I2C_REGISTER_LCD_BACKLIGHT_FADE,    // Fade time for backlight changes in 10 ms steps, 0 switches immediately
+    I2C_REGISTER_LCD_BACKLIGHT_CONFIG,  // Bit 0: gamma corrected brightness instead of a linear duty cycle
+    I2C_REGISTER_LCD_IDLE_DIM_TIMEOUT,  // Seconds without input before the backlight dims, 0 disables
+    I2C_REGISTER_LCD_IDLE_OFF_TIMEOUT,  // Seconds after dimming before the backlight turns off, 0 disables
+    I2C_REGISTER_LCD_IDLE_DIM_LEVEL,    // Backlight level while dimmed
+    I2C_REGISTER_LCD_IDLE_CONFIG,       // Bit 0: stay awake while USB is mounted
+    I2C_REGISTER_LCD_IDLE_STATE,        // 0: active, 1: dimmed, 2: off, a button press or backlight write wakes up
+    I2C_REGISTER_RESERVED45,
+
+    // 208-215
+    I2C_REGISTER_CRASH_RECORD_SIZE,      // Size of the crash record from before the last reboot, 0 when there is none, a burst read starting here continues with the record
+    I2C_REGISTER_CRASH_RECORD_DATA,      // Streaming window: the crash_record_t bytes, restarts whenever the register address is written
+    I2C_REGISTER_CRASH_RECORD_CLEAR,     // Write 1 to discard the crash record
+    I2C_REGISTER_CLOCK_CONFIG,           // Bit 0: governor off, clk_sys stays at full speed, any write resets the residency statistics
+    I2C_REGISTER_CLOCK_MHZ,              // Current clk_sys frequency in MHz
+    I2C_REGISTER_CLOCK_RESIDENCY_BOOST,  // Percentage of the time spent at each governor level since the last reset
+    I2C_REGISTER_CLOCK_RESIDENCY_NORMAL,
+    I2C_REGISTER_CLOCK_RESIDENCY_IDLE,
+
+    // 216-223
+    I2C_REGISTER_STATUS0,  // Start of the i2c_status_t block, a burst read starting here returns one consistent snapshot
+    I2C_REGISTER_STATUS1,
+    I2C_REGISTER_STATUS2,
+    I2C_REGISTER_STATUS3,
+    I2C_REGISTER_STATUS4,
+    I2C_REGISTER_STATUS5,
+    I2C_REGISTER_STATUS6,
+    I2C_REGISTER_STATUS7,
+
+    // 224-231
+    I2C_REGISTER_STATUS8,
+    I2C_REGISTER_STATUS9,
+    I2C_REGISTER_STATUS10,
+    I2C_REGISTER_STATUS11,
+    I2C_REGISTER_STATUS12,
+    I2C_REGISTER_STATUS13,
+    I2C_REGISTER_STATUS14,
+    I2C_REGISTER_STATUS15,
+
+    // 232-239
+    I2C_REGISTER_STATUS16,
+    I2C_REGISTER_STATUS17,
+    I2C_REGISTER_STATUS18,
+    I2C_REGISTER_STATUS19,
+    I2C_REGISTER_STATUS20,
+    I2C_REGISTER_STATUS21,
+    I2C_REGISTER_STATUS22,
+    I2C_REGISTER_STATUS23,
+
+    // ... (240-255)
 };
+
+#define I2C_STATUS_VERSION 1
+
+// Copy of the registers the ESP32 polls, refreshed as a whole between transfers, fields are only ever appended
+typedef struct __attribute__((packed)) {
+    uint8_t  version;    // I2C_STATUS_VERSION
+    uint8_t  size;       // sizeof(i2c_status_t)
+    uint16_t sequence;   // Incremented whenever a field after uptime_ms changed
+    uint32_t uptime_ms;  // Time of the snapshot in milliseconds since boot
+    uint8_t  input1;
+    uint8_t  input2;
+    uint8_t  interrupt1;
+    uint8_t  interrupt2;  // Reading this byte clears the flags reported in interrupt1 and interrupt2
+    uint16_t adc_vusb;
+    uint16_t adc_vbat;
+    uint16_t adc_temp;
+    uint8_t  usb;
+    uint8_t  charging_state;
+    uint8_t  webusb_mode;
+    uint8_t  reserved[3];
+} i2c_status_t;
@@ -0,0 +1,356 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "ir.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "ir_decode.h"
+#include "ir_receive.h"
+#include "ir_transmit.h"
+#include "pico/stdlib.h"
+#include "uart_flow.h"
+
+#define IR_QUEUE_SIZE  8
+#define IR_FRAME_WORDS 64    // Longest encoded frame, NEC takes 36 mark/space pairs
+#define IR_RAW_WORDS   1024  // Raw mark/space pairs, enough for air conditioner remotes
+#define IR_DUTY        33    // Default carrier duty cycle in percent
+
+#define IR_RX_RING_WORDS 256  // Must be a power of two, the DMA wraps the write address
+#define IR_RX_FRAMES     4
+#define IR_RX_TIMEOUT_US 20000  // Silence after which an unrecognised frame is handed out as raw timings
+
+typedef struct {
+    uint8_t  protocol;
+    uint16_t address;
+    uint16_t command;
+    bool     repeat;
+    bool     toggle;
+} ir_frame_t;
+
+static int ir_statemachine = -1;
+static int ir_dma_channel  = -1;
+
+static ir_frame_t ir_queue[IR_QUEUE_SIZE];
+static uint8_t    ir_queue_head = 0;
+static uint8_t    ir_queue_tail = 0;
+
+static uint32_t ir_frame_words[IR_FRAME_WORDS];
+
+static uint32_t          ir_raw_words[IR_RAW_WORDS];
+static volatile uint16_t ir_raw_bytes  = 0;      // Written from the I2C interrupt handler
+static volatile bool     ir_raw_locked = false;  // Raw buffer is queued or playing, writes are ignored
+
+static uint32_t   ir_carrier     = 0;  // Zero selects the default carrier of the protocol
+static uint8_t    ir_duty        = IR_DUTY;
+static bool       ir_active      = false;
+static bool       ir_playing     = false;
+static bool       ir_playing_raw = false;
+static bool       ir_repeating   = false;
+static bool       ir_toggle      = false;
+static ir_frame_t ir_last_frame;
+
+static uint32_t ir_rx_ring[IR_RX_RING_WORDS] __attribute__((aligned(IR_RX_RING_WORDS * sizeof(uint32_t))));
+static int      ir_rx_statemachine = -1;
+static int      ir_rx_dma_channel  = -1;
+static bool     ir_rx_enabled      = false;
+static bool     ir_rx_invert       = false;
+static uint8_t  ir_rx_pin          = 0;
+static bool     ir_rx_overflow     = false;
+static uint32_t ir_rx_read_index   = 0;  // Number of ring words consumed, even words are spaces
+static uint32_t ir_rx_last_edge    = 0;
+
+static ir_decoder_t      ir_decoder;
+static ir_decode_frame_t ir_rx_frames[IR_RX_FRAMES];
+static uint8_t           ir_rx_head         = 0;
+static uint8_t           ir_rx_tail         = 0;
+static volatile uint16_t ir_rx_raw_position = 0;  // Read position of the I2C streaming window in bytes
+
+bool ir_init() {
+    ir_statemachine = ir_tx_init(IR_PIO, IR_PIN);
+    if (ir_statemachine < 0) return false;
+
+    ir_dma_channel = dma_claim_unused_channel(false);
+    if (ir_dma_channel < 0) return false;
+
+    dma_channel_config config = dma_channel_get_default_config(ir_dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(IR_PIO, ir_statemachine, true));
+    dma_channel_configure(ir_dma_channel, &config, &IR_PIO->txf[ir_statemachine], NULL, 0, false);
+
+    ir_rx_statemachine = ir_rx_init(IR_PIO);
+    if (ir_rx_statemachine < 0) return false;
+
+    ir_rx_dma_channel = dma_claim_unused_channel(false);
+    if (ir_rx_dma_channel < 0) return false;
+
+    ir_decoder_init(&ir_decoder);
+    return true;
+}
+
+static uint32_t ir_default_carrier(uint8_t protocol) {
+    switch (protocol) {
+        case IR_PROTOCOL_RC5:
+            return IR_CARRIER_RC5;
+        case IR_PROTOCOL_RC6:
+            return IR_CARRIER_RC6;
+        case IR_PROTOCOL_SIRC12:
+        case IR_PROTOCOL_SIRC15:
+        case IR_PROTOCOL_SIRC20:
+            return IR_CARRIER_SIRC;
+        case IR_PROTOCOL_NEC:
+        case IR_PROTOCOL_RAW:
+        default:
+            return IR_CARRIER_NEC;
+    }
+}
+
+static bool ir_encode(ir_tx_buffer_t* buffer, ir_frame_t* frame) {
+    switch (frame->protocol) {
+        case IR_PROTOCOL_NEC:
+            return ir_encode_nec(buffer, frame->address | ((uint32_t) frame->command << 16), frame->repeat);
+        case IR_PROTOCOL_RC5:
+            return ir_encode_rc5(buffer, frame->address, frame->command, frame->toggle);
+        case IR_PROTOCOL_RC6:
+            return ir_encode_rc6(buffer, frame->address, frame->command, frame->toggle);
+        case IR_PROTOCOL_SIRC12:
+            return ir_encode_sirc(buffer, frame->address & 0x1F, frame->command, 12);
+        case IR_PROTOCOL_SIRC15:
+            return ir_encode_sirc(buffer, frame->address & 0xFF, frame->command, 15);
+        case IR_PROTOCOL_SIRC20:
+            return ir_encode_sirc(buffer, (frame->address & 0x1F) | ((frame->address >> 8) << 5), frame->command, 20);
+        default:
+            return false;
+    }
+}
+
+static void ir_start(ir_frame_t* frame) {
+    uint32_t* words;
+    uint      length;
+
+    if (frame->protocol == IR_PROTOCOL_RAW) {
+        words  = ir_raw_words;
+        length = ir_raw_bytes / sizeof(uint32_t);
+    } else {
+        ir_tx_buffer_t buffer;
+        ir_tx_buffer_init(&buffer, ir_frame_words, IR_FRAME_WORDS);
+        if (!ir_encode(&buffer, frame)) return;
+        words  = ir_frame_words;
+        length = buffer.length;
+    }
+
+    uint32_t carrier = ir_carrier ? ir_carrier : ir_default_carrier(frame->protocol);
+    ir_tx_convert(words, length, carrier);
+    ir_tx_stop(IR_PIO, ir_statemachine);
+    ir_tx_set_carrier(IR_PIO, ir_statemachine, carrier, ir_duty);
+    dma_channel_transfer_from_buffer_now(ir_dma_channel, words, length);
+    ir_tx_start(IR_PIO, ir_statemachine);
+    ir_playing     = true;
+    ir_playing_raw = (frame->protocol == IR_PROTOCOL_RAW);
+}
+
+static bool ir_queue_push(ir_frame_t* frame) {
+    uint8_t head = (ir_queue_head + 1) % IR_QUEUE_SIZE;
+    if (head == ir_queue_tail) return false;
+    ir_queue[ir_queue_head] = *frame;
+    ir_queue_head           = head;
+    ir_active               = true;
+    return true;
+}
+
+bool ir_queue_frame(uint8_t protocol, uint16_t address, uint16_t command) {
+    if (protocol == IR_PROTOCOL_NEC) {
+        command = (command & 0xFF) | ((~command & 0xFF) << 8);  // Inverted command byte as checksum
+    }
+    ir_toggle        = !ir_toggle;  // New key press for protocols with a toggle bit
+    ir_frame_t frame = {.protocol = protocol, .address = address, .command = command, .repeat = false, .toggle = ir_toggle};
+    if (!ir_queue_push(&frame)) return false;
+    ir_last_frame = frame;
+    return true;
+}
+
+bool ir_queue_repeat() {
+    // NEC has a dedicated repeat code, the other protocols resend the frame with the same toggle bit
+    ir_frame_t frame = ir_last_frame;
+    frame.repeat     = true;
+    return ir_queue_push(&frame);
+}
+
+bool ir_queue_raw() {
+    if (ir_raw_locked || (ir_raw_bytes < sizeof(uint32_t))) return false;
+    ir_frame_t frame = {.protocol = IR_PROTOCOL_RAW};
+    ir_raw_locked    = true;
+    if (!ir_queue_push(&frame)) {
+        ir_raw_locked = false;
+        return false;
+    }
+    return true;
+}
+
+void ir_raw_clear() {
+    if (!ir_raw_locked) ir_raw_bytes = 0;
+}
+
+void __not_in_flash_func(ir_raw_write)(uint8_t value) {
+    // Little endian 16-bit mark and space lengths in microseconds, straight from the I2C streaming window
+    if (ir_raw_locked || (ir_raw_bytes >= sizeof(ir_raw_words))) return;
+    ((uint8_t*) ir_raw_words)[ir_raw_bytes] = value;
+    ir_raw_bytes                            = ir_raw_bytes + 1;
+}
+
+uint16_t ir_raw_count() { return ir_raw_bytes / sizeof(uint32_t); }
+
+bool ir_raw_full() { return ir_raw_locked || (ir_raw_bytes >= sizeof(ir_raw_words)); }
+
+void ir_set_carrier(uint32_t frequency, uint8_t duty) {
+    ir_carrier = frequency;
+    ir_duty    = duty ? duty : IR_DUTY;
+}
+
+void ir_set_repeating(bool enable) { ir_repeating = enable; }
+
+bool ir_busy() { return ir_active; }
+
+bool ir_queue_full() { return ((ir_queue_head + 1) % IR_QUEUE_SIZE) == ir_queue_tail; }
+
+bool ir_task() {
+    if (ir_playing) {
+        if (dma_channel_is_busy(ir_dma_channel) || !ir_tx_idle(IR_PIO, ir_statemachine)) return false;
+        ir_playing = false;
+        if (ir_playing_raw) {
+            ir_playing_raw = false;
+            ir_raw_bytes   = 0;  // Played buffer was converted to carrier cycles in place
+            ir_raw_locked  = false;
+        }
+    }
+
+    if ((ir_queue_head == ir_queue_tail) && ir_repeating) {
+        ir_queue_repeat();
+    }
+
+    if (ir_queue_head == ir_queue_tail) {
+        if (ir_active) {
+            ir_active = false;
+            return true;  // Queue drained and last frame sent
+        }
+        return false;
+    }
+
+    ir_start(&ir_queue[ir_queue_tail]);
+    ir_queue_tail = (ir_queue_tail + 1) % IR_QUEUE_SIZE;
+    return false;
+}
+
+void ir_clock_changed() {
+    // The transmitter derives its carrier divider from the clock for every frame, only the receiver needs updating
+    if (ir_rx_statemachine >= 0) ir_rx_clock_changed(IR_PIO, ir_rx_statemachine);
+}
+
+bool ir_rx_configure(bool enable, uint8_t pin, bool invert) {
+    if (uart_flow_owns_pin(pin)) enable = false;  // A CTS or RTS line of an enabled RTS/CTS mode, the PIO must not take it over
+
+    ir_rx_stop(IR_PIO, ir_rx_statemachine);
+    dma_channel_abort(ir_rx_dma_channel);
+    if (ir_rx_enabled) {  // Hand the previous pin back to the GPIO registers, without the pull-up the receiver needed
+        gpio_disable_pulls(ir_rx_pin);
+        gpio_set_function(ir_rx_pin, GPIO_FUNC_SIO);
+    }
+    ir_rx_enabled = enable;
+    ir_rx_pin     = pin;
+    ir_rx_invert  = invert;
+    if (!enable) return false;
+
+    gpio_pull_up(pin);  // Receiver modules have an open collector or weak output
+
+    // The DMA keeps writing into the ring, the transfer count tells how many words arrived
+    dma_channel_config config = dma_channel_get_default_config(ir_rx_dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, __builtin_ctz(sizeof(ir_rx_ring)));
+    channel_config_set_dreq(&config, pio_get_dreq(IR_PIO, ir_rx_statemachine, false));
+    dma_channel_configure(ir_rx_dma_channel, &config, ir_rx_ring, &IR_PIO->rxf[ir_rx_statemachine], 0xFFFFFFFF, true);
+
+    ir_rx_read_index = 0;
+    ir_rx_last_edge  = time_us_32();
+    ir_decoder_init(&ir_decoder);
+    ir_rx_start(IR_PIO, ir_rx_statemachine, pin);
+    return true;
+}
+
+bool ir_rx_owns_pin(uint8_t gpio) { return ir_rx_enabled && (gpio == ir_rx_pin); }
+
+static void ir_rx_push(ir_decode_frame_t* frame) {
+    uint8_t head = (ir_rx_head + 1) % IR_RX_FRAMES;
+    if (head == ir_rx_tail) {
+        ir_rx_overflow = true;  // ESP32 is not keeping up, drop the newest frame
+        return;
+    }
+    ir_rx_frames[ir_rx_head] = *frame;
+    ir_rx_head               = head;
+}
+
+bool ir_rx_task() {
+    if (!ir_rx_enabled) return false;
+
+    bool              was_empty = (ir_rx_head == ir_rx_tail);
+    ir_decode_frame_t frame;
+
+    uint32_t written = 0xFFFFFFFF - dma_hw->ch[ir_rx_dma_channel].transfer_count;
+    if (written - ir_rx_read_index > IR_RX_RING_WORDS) {
+        ir_rx_read_index = written - IR_RX_RING_WORDS;  // Lost words, the index keeps the space/mark parity
+        ir_rx_overflow   = true;
+    }
+
+    while (ir_rx_read_index != written) {
+        bool mark = (ir_rx_read_index & 1) ^ ir_rx_invert;
+        if (ir_decoder_feed(&ir_decoder, mark, ir_rx_ring[ir_rx_read_index % IR_RX_RING_WORDS], &frame)) {
+            ir_rx_push(&frame);
+        }
+        ir_rx_read_index++;
+        ir_rx_last_edge = time_us_32();
+    }
+
+    // The trailing space of a frame only ends with the next edge, so time it out here
+    if ((time_us_32() - ir_rx_last_edge) > IR_RX_TIMEOUT_US) {
+        if (ir_decoder_timeout(&ir_decoder, &frame)) {
+            ir_rx_push(&frame);
+        }
+        ir_rx_last_edge = time_us_32();
+    }
+
+    return was_empty && (ir_rx_head != ir_rx_tail);  // A frame became available
+}
+
+ir_decode_frame_t* ir_rx_frame() { return (ir_rx_head != ir_rx_tail) ? &ir_rx_frames[ir_rx_tail] : NULL; }
+
+void ir_rx_pop() {
+    if (ir_rx_head != ir_rx_tail) ir_rx_tail = (ir_rx_tail + 1) % IR_RX_FRAMES;
+    ir_rx_raw_position = 0;
+}
+
+bool ir_rx_overflowed() {
+    bool overflow  = ir_rx_overflow;
+    ir_rx_overflow = false;
+    return overflow;
+}
+
+uint8_t __not_in_flash_func(ir_rx_raw_read)() {
+    // Little endian 16-bit lengths of the current frame, starting with a mark
+    if (ir_rx_head == ir_rx_tail) return 0;
+    ir_decode_frame_t* frame = &ir_rx_frames[ir_rx_tail];
+    if (ir_rx_raw_position >= frame->raw_length * sizeof(uint16_t)) return 0;
+    uint8_t value      = ((uint8_t*) frame->raw)[ir_rx_raw_position];
+    ir_rx_raw_position = ir_rx_raw_position + 1;
+    return value;
+}
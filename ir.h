@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ir_decode.h"
+
+enum {
+    IR_PROTOCOL_NEC,     // 16-bit address, 8-bit command (sent with its inverse)
+    IR_PROTOCOL_RC5,     // 5-bit address, 7-bit command
+    IR_PROTOCOL_RC6,     // Mode 0, 8-bit address, 8-bit command
+    IR_PROTOCOL_SIRC12,  // 5-bit address, 7-bit command
+    IR_PROTOCOL_SIRC15,  // 8-bit address, 7-bit command
+    IR_PROTOCOL_SIRC20,  // 5-bit address in the low byte, 8-bit extended address in the high byte, 7-bit command
+    IR_PROTOCOL_RAW,     // Mark/space pairs from the raw buffer
+};
+
+bool ir_init();
+bool ir_task();  // Returns true once when the queue has drained and the last frame went out
+
+bool ir_queue_frame(uint8_t protocol, uint16_t address, uint16_t command);
+bool ir_queue_repeat();
+bool ir_queue_raw();
+void ir_set_repeating(bool enable);  // Keep sending repeat codes, like a held remote control button
+void ir_set_carrier(uint32_t frequency, uint8_t duty);
+
+// Raw buffer, filled with little endian 16-bit mark and space lengths in microseconds
+void     ir_raw_write(uint8_t value);
+void     ir_raw_clear();
+uint16_t ir_raw_count();
+bool     ir_raw_full();
+
+bool ir_busy();
+bool ir_queue_full();
+void ir_clock_changed();  // Recalculates the receiver divider after a system clock change
+
+// Receiver, frames are decoded in the main loop and queued until popped
+bool               ir_rx_configure(bool enable, uint8_t pin, bool invert);  // Returns false when the receiver stays disabled
+bool               ir_rx_owns_pin(uint8_t gpio);
+bool               ir_rx_task();  // Returns true when a frame became available
+ir_decode_frame_t* ir_rx_frame();
+void               ir_rx_pop();
+bool               ir_rx_overflowed();
+uint8_t            ir_rx_raw_read();  // I2C streaming window
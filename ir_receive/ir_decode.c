@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "ir_decode.h"
+
+#include <string.h>
+
+// spaces longer than this end a frame
+//
+#define IR_DECODE_GAP_US 15000
+
+enum {
+    NEC_LEADER_MARK,
+    NEC_LEADER_SPACE,
+    NEC_BIT_MARK,
+    NEC_BIT_SPACE,
+    NEC_REPEAT_MARK,
+    NEC_DONE,  // Frame decoded or not NEC at all, wait for the gap
+};
+
+static bool ir_within(uint32_t length_us, uint32_t min_us, uint32_t max_us) { return (length_us >= min_us) && (length_us <= max_us); }
+
+static void ir_decoder_reset(ir_decoder_t* decoder) {
+    decoder->state            = NEC_LEADER_MARK;
+    decoder->bits             = 0;
+    decoder->data             = 0;
+    decoder->decoded          = false;
+    decoder->frame.raw_length = 0;
+}
+
+void ir_decoder_init(ir_decoder_t* decoder) {
+    memset(decoder, 0, sizeof(ir_decoder_t));
+    ir_decoder_reset(decoder);
+}
+
+static bool ir_decoder_emit_nec(ir_decoder_t* decoder, bool repeat, ir_decode_frame_t* output) {
+    decoder->decoded = true;
+    decoder->state   = NEC_DONE;
+    if (repeat && !decoder->have_last) return false;  // Repeat code without a frame to repeat
+    if (!repeat) {
+        decoder->last_data = decoder->data;
+        decoder->have_last = true;
+    }
+    decoder->frame.protocol = IR_DECODE_NEC;
+    decoder->frame.repeat   = repeat;
+    decoder->frame.address  = decoder->last_data & 0xFFFF;
+    decoder->frame.command  = decoder->last_data >> 16;
+    memcpy(output, &decoder->frame, sizeof(ir_decode_frame_t));
+    return true;
+}
+
+static bool ir_decoder_nec(ir_decoder_t* decoder, bool mark, uint32_t length_us, ir_decode_frame_t* output) {
+    // 9ms leader, 4.5ms space (2.25ms for a repeat code), 32 bits LSB first: 562us mark, 562us or 1687us space
+    switch (decoder->state) {
+        case NEC_LEADER_MARK:
+            decoder->state = (mark && ir_within(length_us, 7000, 11000)) ? NEC_LEADER_SPACE : NEC_DONE;
+            break;
+        case NEC_LEADER_SPACE:
+            if (ir_within(length_us, 3500, 5500)) {
+                decoder->state = NEC_BIT_MARK;
+            } else if (ir_within(length_us, 1700, 2800)) {
+                decoder->state = NEC_REPEAT_MARK;
+            } else {
+                decoder->state = NEC_DONE;
+            }
+            break;
+        case NEC_BIT_MARK:
+            if (!ir_within(length_us, 300, 900)) {
+                decoder->state = NEC_DONE;
+            } else if (decoder->bits == 32) {
+                return ir_decoder_emit_nec(decoder, false, output);  // Stop bit
+            } else {
+                decoder->state = NEC_BIT_SPACE;
+            }
+            break;
+        case NEC_BIT_SPACE:
+            if (ir_within(length_us, 300, 1125)) {
+                decoder->bits++;
+            } else if (ir_within(length_us, 1125, 2200)) {
+                decoder->data |= 1UL << decoder->bits;
+                decoder->bits++;
+            } else {
+                decoder->state = NEC_DONE;
+                break;
+            }
+            decoder->state = NEC_BIT_MARK;
+            break;
+        case NEC_REPEAT_MARK:
+            if (ir_within(length_us, 300, 900)) {
+                return ir_decoder_emit_nec(decoder, true, output);
+            }
+            decoder->state = NEC_DONE;
+            break;
+        case NEC_DONE:
+        default:
+            break;
+    }
+    return false;
+}
+
+bool ir_decoder_timeout(ir_decoder_t* decoder, ir_decode_frame_t* output) {
+    // frames that were not recognised are handed out as raw timings
+    bool emit = !decoder->decoded && (decoder->frame.raw_length > 0);
+    if (emit) {
+        decoder->frame.protocol = IR_DECODE_RAW;
+        decoder->frame.repeat   = false;
+        decoder->frame.address  = 0;
+        decoder->frame.command  = 0;
+        memcpy(output, &decoder->frame, sizeof(ir_decode_frame_t));
+    }
+    ir_decoder_reset(decoder);
+    return emit;
+}
+
+bool ir_decoder_feed(ir_decoder_t* decoder, bool mark, uint32_t length_us, ir_decode_frame_t* output) {
+    if (!mark && (length_us >= IR_DECODE_GAP_US)) {
+        return ir_decoder_timeout(decoder, output);
+    }
+
+    if (!mark && (decoder->frame.raw_length == 0)) {
+        return false;  // Frames start with a mark
+    }
+
+    if (decoder->frame.raw_length < IR_DECODE_RAW_MAX) {
+        decoder->frame.raw[decoder->frame.raw_length++] = (length_us > 0xFFFF) ? 0xFFFF : length_us;
+    }
+
+    return ir_decoder_nec(decoder, mark, length_us, output);
+}
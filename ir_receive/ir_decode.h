@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// the decoder has no hardware dependencies, it can be fed recorded timings on a host
+
+#define IR_DECODE_RAW_MAX 128  // mark/space lengths kept per frame
+
+enum {
+    IR_DECODE_NEC = 0,  // Same values as the transmit protocols
+    IR_DECODE_RAW = 6,
+};
+
+typedef struct {
+    uint8_t  protocol;
+    bool     repeat;
+    uint16_t address;
+    uint16_t command;
+    uint8_t  raw_length;
+    uint16_t raw[IR_DECODE_RAW_MAX];  // Lengths in microseconds, starting with a mark
+} ir_decode_frame_t;
+
+typedef struct {
+    uint8_t           state;
+    uint8_t           bits;
+    uint32_t          data;
+    uint32_t          last_data;
+    bool              have_last;
+    bool              decoded;
+    ir_decode_frame_t frame;
+} ir_decoder_t;
+
+void ir_decoder_init(ir_decoder_t* decoder);
+bool ir_decoder_feed(ir_decoder_t* decoder, bool mark, uint32_t length_us, ir_decode_frame_t* output);
+bool ir_decoder_timeout(ir_decoder_t* decoder, ir_decode_frame_t* output);
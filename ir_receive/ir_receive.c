@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+// SDK types and declarations
+//
+#include "hardware/clocks.h"  // for clock_get_hz()
+#include "hardware/pio.h"
+#include "pico/stdlib.h"
+
+// public API declarations
+//
+#include "ir_receive.h"
+
+// PIO state machine program:
+//
+#include "ir_receive.pio.h"
+
+// program offsets, one receiver per PIO block
+//
+static uint ir_rx_offset[2];
+
+// public API definitions
+//
+int ir_rx_init(PIO pio) {
+    // load the edge timing program and claim a state machine for it, the state machine is started by ir_rx_start()
+    // returns state machine number on success, otherwise -1 if an error occurred
+    uint offset = pio_add_program(pio, &ir_receive_program);
+    int  sm     = pio_claim_unused_sm(pio, true);
+
+    if (sm == -1) {
+        return -1;
+    }
+
+    ir_rx_offset[pio_get_index(pio)] = offset;
+    return sm;
+}
+
+void ir_rx_start(PIO pio, int sm, uint pin_num) {
+    // (re)start measuring the levels on the specified GPIO pin in microseconds
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_clear_fifos(pio, sm);
+    ir_receive_program_init(pio, sm, ir_rx_offset[pio_get_index(pio)], pin_num, 1e6);
+}
+
+void ir_rx_stop(PIO pio, int sm) { pio_sm_set_enabled(pio, sm, false); }
+
+void ir_rx_clock_changed(PIO pio, int sm) {
+    // keep counting in microseconds after the system clock changed, same divider as ir_receive_program_init()
+    pio_sm_set_clkdiv(pio, sm, clock_get_hz(clk_sys) / (2 * 1e6));
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "hardware/pio.h"
+#include "pico/stdlib.h"
+
+// public API
+//
+int  ir_rx_init(PIO);
+void ir_rx_start(PIO, int, uint);
+void ir_rx_stop(PIO, int);
+void ir_rx_clock_changed(PIO, int);
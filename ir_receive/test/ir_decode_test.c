@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir_decode.h"
+
+// Mark/space lengths in microseconds as captured by the receiver, starting with a mark
+
+// NEC, address 0x40BF, command 0x08 with its inverse
+static const uint16_t nec_frame[] = {
+    9046, 4473, 561,  1639, 570,  1703, 526,  1629, 625,  1688, 532,  1666, 594,  1627, 584, 517,  524, 1631, 575, 543,  528,  520,
+    531,  560,  574,  497,  625,  562,  535,  518,  600,  1700, 594,  497,  593,  564,  570, 496,  548, 495,  591, 1729, 537,  527,
+    573,  508,  589,  505,  593,  529,  591,  1724, 607,  1643, 533,  1694, 593,  571,  544, 1667, 532, 1690, 611, 1628, 592,  1627,
+    581,
+};
+
+static const uint16_t nec_repeat[] = {9012, 2231, 574};
+
+// The same frame with a 120 us dropout in the mark of bit 6, as caused by interference
+static const uint16_t nec_glitch[] = {
+    9046, 4473, 561,  1639, 570,  1703, 526,  1629, 625,  1688, 532,  1666, 594,  1627, 250, 120,  214,  517,  524, 1631, 575, 543,
+    528,  520,  531,  560,  574,  497,  625,  562,  535,  518,  600,  1700, 594,  497,  593, 564,  570,  496,  548, 495,  591, 1729,
+    537,  527,  573,  508,  589,  505,  593,  529,  591,  1724, 607,  1643, 533,  1694, 593, 571,  544,  1667, 532, 1690, 611, 1628,
+    592,  1627, 581,
+};
+
+#define GAP_US 40000  // Between frames, longer than the end of frame gap
+
+static int failures = 0;
+
+#define CHECK(condition)                                                         \
+    do {                                                                         \
+        if (!(condition)) {                                                      \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                          \
+        }                                                                        \
+    } while (0)
+
+// Feeds the lengths followed by the gap, returns the number of frames decoded and keeps the last one
+static int feed(ir_decoder_t* decoder, const uint16_t* lengths, size_t count, ir_decode_frame_t* output) {
+    int frames = 0;
+    for (size_t index = 0; index < count; index++) {
+        if (ir_decoder_feed(decoder, (index & 1) == 0, lengths[index], output)) frames++;
+    }
+    if (ir_decoder_feed(decoder, false, GAP_US, output)) frames++;
+    return frames;
+}
+
+static void test_frame() {
+    ir_decoder_t      decoder;
+    ir_decode_frame_t frame;
+    ir_decoder_init(&decoder);
+
+    CHECK(feed(&decoder, nec_frame, sizeof(nec_frame) / sizeof(nec_frame[0]), &frame) == 1);
+    CHECK(frame.protocol == IR_DECODE_NEC);
+    CHECK(!frame.repeat);
+    CHECK(frame.address == 0x40BF);
+    CHECK(frame.command == 0xF708);
+    CHECK(frame.raw_length == sizeof(nec_frame) / sizeof(nec_frame[0]));
+}
+
+static void test_repeat() {
+    ir_decoder_t      decoder;
+    ir_decode_frame_t frame;
+    ir_decoder_init(&decoder);
+
+    // A repeat code without a frame before it has nothing to repeat
+    CHECK(feed(&decoder, nec_repeat, sizeof(nec_repeat) / sizeof(nec_repeat[0]), &frame) == 0);
+
+    CHECK(feed(&decoder, nec_frame, sizeof(nec_frame) / sizeof(nec_frame[0]), &frame) == 1);
+    for (int repeat = 0; repeat < 3; repeat++) {
+        memset(&frame, 0, sizeof(frame));
+        CHECK(feed(&decoder, nec_repeat, sizeof(nec_repeat) / sizeof(nec_repeat[0]), &frame) == 1);
+        CHECK(frame.protocol == IR_DECODE_NEC);
+        CHECK(frame.repeat);
+        CHECK(frame.address == 0x40BF);
+        CHECK(frame.command == 0xF708);
+    }
+}
+
+static void test_glitch() {
+    ir_decoder_t      decoder;
+    ir_decode_frame_t frame;
+    ir_decoder_init(&decoder);
+
+    // The broken frame comes out as raw timings instead of a wrong command
+    CHECK(feed(&decoder, nec_glitch, sizeof(nec_glitch) / sizeof(nec_glitch[0]), &frame) == 1);
+    CHECK(frame.protocol == IR_DECODE_RAW);
+    CHECK(frame.raw_length == sizeof(nec_glitch) / sizeof(nec_glitch[0]));
+    CHECK(frame.raw[14] == 250);
+
+    // And the decoder is back in sync for the next frame
+    CHECK(feed(&decoder, nec_frame, sizeof(nec_frame) / sizeof(nec_frame[0]), &frame) == 1);
+    CHECK(frame.protocol == IR_DECODE_NEC);
+    CHECK(frame.command == 0xF708);
+
+    // A repeat code after a broken frame repeats the last good one
+    CHECK(feed(&decoder, nec_glitch, sizeof(nec_glitch) / sizeof(nec_glitch[0]), &frame) == 1);
+    CHECK(feed(&decoder, nec_repeat, sizeof(nec_repeat) / sizeof(nec_repeat[0]), &frame) == 1);
+    CHECK(frame.repeat);
+    CHECK(frame.address == 0x40BF);
+}
+
+int main(void) {
+    test_frame();
+    test_repeat();
+    test_glitch();
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+// SDK types and declarations
+//
+#include "hardware/clocks.h"  // for clock_get_hz()
+#include "hardware/pio.h"
+#include "pico/stdlib.h"
+
+// public API declarations
+//
+#include "ir_transmit.h"
+
+// PIO state machine program:
+//
+#include "ir_transmit.pio.h"
+
+// program offsets, one transmitter per PIO block
+//
+static uint ir_tx_offset[2];
+
+// public API definitions
+//
+int ir_tx_init(PIO pio, uint pin_num) {
+    // initialise PIO to play mark/space pairs on specified GPIO pin
+    // returns state machine number on success, otherwise -1 if an error occurred
+    uint offset = pio_add_program(pio, &ir_transmit_program);
+    int  sm     = pio_claim_unused_sm(pio, true);
+
+    if (sm == -1) {
+        return -1;
+    }
+
+    ir_tx_offset[pio_get_index(pio)] = offset;
+    ir_transmit_program_init(pio, sm, offset, pin_num, IR_CARRIER_NEC);
+    ir_transmit_program_set_duty(pio, offset, 33);
+    return sm;
+}
+
+void ir_tx_set_carrier(PIO pio, int sm, uint32_t freq, uint duty_percent) {
+    // only change the carrier while the state machine is idle, the duty cycle is shared by the whole program
+    ir_transmit_program_set_carrier(pio, sm, freq);
+    ir_transmit_program_set_duty(pio, ir_tx_offset[pio_get_index(pio)], duty_percent);
+}
+
+void ir_tx_convert(uint32_t* words, uint length, uint32_t freq) {
+    // convert mark/space pairs from microseconds to carrier cycles in place
+    for (uint index = 0; index < length; index++) {
+        uint32_t mark  = ((uint64_t) (words[index] & 0xFFFF) * freq + 500000) / 1000000;
+        uint32_t space = ((uint64_t) (words[index] >> 16) * freq + 500000) / 1000000;
+        words[index]   = mark | (space << 16);
+    }
+}
+
+void ir_tx_stop(PIO pio, int sm) {
+    // stop the state machine before the next frame is handed to the DMA and forget the stall of the previous frame
+    pio_sm_set_enabled(pio, sm, false);
+    pio->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+}
+
+void ir_tx_start(PIO pio, int sm) {
+    // only run once the first pair is in the FIFO, a stall from here on means the frame is done
+    while (pio_sm_is_tx_fifo_empty(pio, sm)) tight_loop_contents();
+    pio_sm_set_enabled(pio, sm, true);
+}
+
+bool ir_tx_idle(PIO pio, int sm) {
+    // the state machine stalls on the autopull at the wrap target once the last pair went out
+    return pio_sm_is_tx_fifo_empty(pio, sm) && (pio->fdebug & (1u << (PIO_FDEBUG_TXSTALL_LSB + sm)));
+}
+
+// frame building
+//
+void ir_tx_buffer_init(ir_tx_buffer_t* buffer, uint32_t* words, uint capacity) {
+    buffer->words       = words;
+    buffer->capacity    = capacity;
+    buffer->length      = 0;
+    buffer->duration_us = 0;
+}
+
+bool ir_tx_mark(ir_tx_buffer_t* buffer, uint32_t us) {
+    // consecutive marks are merged, a mark after a space starts a new pair
+    buffer->duration_us += us;
+    if ((buffer->length > 0) && ((buffer->words[buffer->length - 1] >> 16) == 0)) {
+        uint32_t mark = (buffer->words[buffer->length - 1] & 0xFFFF) + us;
+        if (mark <= 0xFFFF) {
+            buffer->words[buffer->length - 1] = mark;
+            return true;
+        }
+        return false;
+    }
+    if ((buffer->length >= buffer->capacity) || (us > 0xFFFF)) return false;
+    buffer->words[buffer->length++] = us;
+    return true;
+}
+
+bool ir_tx_space(ir_tx_buffer_t* buffer, uint32_t us) {
+    // spaces longer than a single pair can hold continue in pairs without a mark
+    buffer->duration_us += us;
+    while (us > 0) {
+        if (buffer->length == 0) {
+            buffer->words[buffer->length++] = 0;
+        }
+        uint32_t space = buffer->words[buffer->length - 1] >> 16;
+        uint32_t add   = MIN(us, 0xFFFF - space);
+        buffer->words[buffer->length - 1] += add << 16;
+        us -= add;
+        if (us > 0) {
+            if (buffer->length >= buffer->capacity) return false;
+            buffer->words[buffer->length++] = 0;
+        }
+    }
+    return true;
+}
+
+bool ir_tx_pad(ir_tx_buffer_t* buffer, uint32_t period_us) {
+    // append silence so the next frame starts period_us after the start of this one
+    if (buffer->duration_us >= period_us) return true;
+    return ir_tx_space(buffer, period_us - buffer->duration_us);
+}
+
+// protocol encoders
+//
+bool ir_encode_nec(ir_tx_buffer_t* buffer, uint32_t data, bool repeat) {
+    // 9ms leader, 4.5ms space (2.25ms for a repeat code), 32 bits LSB first, frames start 108ms apart
+    bool ok = ir_tx_mark(buffer, 9000);
+    if (repeat) {
+        ok &= ir_tx_space(buffer, 2250);
+    } else {
+        ok &= ir_tx_space(buffer, 4500);
+        for (uint bit = 0; bit < 32; bit++) {
+            ok &= ir_tx_mark(buffer, 562);
+            ok &= ir_tx_space(buffer, ((data >> bit) & 1) ? 1687 : 562);
+        }
+    }
+    ok &= ir_tx_mark(buffer, 562);
+    ok &= ir_tx_pad(buffer, 108000);
+    return ok;
+}
+
+static bool ir_tx_biphase(ir_tx_buffer_t* buffer, bool first_half_mark, uint32_t half_us) {
+    // one Manchester coded bit
+    bool ok = true;
+    if (first_half_mark) {
+        ok &= ir_tx_mark(buffer, half_us);
+        ok &= ir_tx_space(buffer, half_us);
+    } else {
+        ok &= ir_tx_space(buffer, half_us);
+        ok &= ir_tx_mark(buffer, half_us);
+    }
+    return ok;
+}
+
+bool ir_encode_rc5(ir_tx_buffer_t* buffer, uint8_t address, uint8_t command, bool toggle) {
+    // start bit, field bit (inverted command bit 6, RC5X), toggle, 5 address bits, 6 command bits, MSB first
+    // a '1' is a space followed by a mark, frames start 113.778ms apart
+    uint16_t frame = (1 << 13) | ((!(command & 0x40)) << 12) | (toggle << 11) | ((address & 0x1F) << 6) | (command & 0x3F);
+    bool     ok    = true;
+    for (int bit = 13; bit >= 0; bit--) {
+        ok &= ir_tx_biphase(buffer, !((frame >> bit) & 1), 889);
+    }
+    ok &= ir_tx_pad(buffer, 113778);
+    return ok;
+}
+
+bool ir_encode_rc6(ir_tx_buffer_t* buffer, uint8_t address, uint8_t command, bool toggle) {
+    // mode 0: 2.666ms leader, 889us space, start bit, 3 mode bits, double width toggle bit, 8 address bits, 8 command bits
+    // a '1' is a mark followed by a space, frames start 106.7ms apart
+    bool ok = ir_tx_mark(buffer, 2666);
+    ok &= ir_tx_space(buffer, 889);
+    ok &= ir_tx_biphase(buffer, true, 444);  // Start bit
+    for (uint bit = 0; bit < 3; bit++) {
+        ok &= ir_tx_biphase(buffer, false, 444);  // Mode 0
+    }
+    ok &= ir_tx_biphase(buffer, toggle, 889);
+    uint16_t data = (address << 8) | command;
+    for (int bit = 15; bit >= 0; bit--) {
+        ok &= ir_tx_biphase(buffer, (data >> bit) & 1, 444);
+    }
+    ok &= ir_tx_pad(buffer, 106700);
+    return ok;
+}
+
+bool ir_encode_sirc(ir_tx_buffer_t* buffer, uint16_t address, uint8_t command, uint bits) {
+    // 2.4ms leader, 7 command bits then 5, 8 or 13 address bits, LSB first, 600us spaces
+    // a '1' is a 1.2ms mark, a '0' a 600us mark, frames start 45ms apart
+    uint32_t data = (command & 0x7F) | ((uint32_t) address << 7);
+    bool     ok   = ir_tx_mark(buffer, 2400);
+    ok &= ir_tx_space(buffer, 600);
+    for (uint bit = 0; bit < bits; bit++) {
+        ok &= ir_tx_mark(buffer, ((data >> bit) & 1) ? 1200 : 600);
+        ok &= ir_tx_space(buffer, 600);
+    }
+    ok &= ir_tx_pad(buffer, 45000);
+    return ok;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "hardware/pio.h"
+#include "pico/stdlib.h"
+
+// mark/space pairs are built in microseconds: mark in bits 0-15, space in bits 16-31
+//
+typedef struct {
+    uint32_t* words;
+    uint      capacity;
+    uint      length;
+    uint32_t  duration_us;
+} ir_tx_buffer_t;
+
+// default carriers of the supported protocols
+//
+#define IR_CARRIER_NEC  38000
+#define IR_CARRIER_RC5  36000
+#define IR_CARRIER_RC6  36000
+#define IR_CARRIER_SIRC 40000
+
+// public API
+//
+int  ir_tx_init(PIO, uint);
+void ir_tx_set_carrier(PIO, int, uint32_t, uint);
+void ir_tx_convert(uint32_t*, uint, uint32_t);
+void ir_tx_stop(PIO, int);
+void ir_tx_start(PIO, int);
+bool ir_tx_idle(PIO, int);
+
+// frame building
+//
+void ir_tx_buffer_init(ir_tx_buffer_t*, uint32_t*, uint);
+bool ir_tx_mark(ir_tx_buffer_t*, uint32_t);
+bool ir_tx_space(ir_tx_buffer_t*, uint32_t);
+bool ir_tx_pad(ir_tx_buffer_t*, uint32_t);
+
+// protocol encoders
+//
+bool ir_encode_nec(ir_tx_buffer_t*, uint32_t, bool);
+bool ir_encode_rc5(ir_tx_buffer_t*, uint8_t, uint8_t, bool);
+bool ir_encode_rc6(ir_tx_buffer_t*, uint8_t, uint8_t, bool);
+bool ir_encode_sirc(ir_tx_buffer_t*, uint16_t, uint8_t, uint);
@@ -12,20 +12,91 @@
 
 #include "bsp/board.h"
 #include "hardware.h"
+#include "hardware/clocks.h"
+#include "hardware/irq.h"
 #include "hardware/pwm.h"
 #include "pico/stdlib.h"
 
-uint32_t pwm_set_freq_duty(uint slice_num, uint chan, uint32_t freq, int duty) {
-    uint32_t clock     = 125000000;
-    uint32_t divider16 = clock / freq / 4096 + (clock % (freq * 4096) != 0);
+#define LCD_BACKLIGHT_FREQUENCY 200  // Hz, fades advance one step per PWM period
+
+// Gamma 2.2 curve, brightness level to duty cycle scaled to 16 bits
+static const uint16_t lcd_gamma[256] = {
+        0,     0,     2,     4,     7,    11,    17,    24,    32,    42,    53,    65,    79,    94,   111,   129,
+      148,   169,   192,   216,   242,   270,   299,   330,   362,   396,   432,   469,   508,   549,   591,   635,
+      681,   729,   779,   830,   883,   938,   995,  1053,  1113,  1175,  1239,  1305,  1373,  1443,  1514,  1587,
+     1663,  1740,  1819,  1900,  1983,  2068,  2155,  2243,  2334,  2427,  2521,  2618,  2717,  2817,  2920,  3024,
+     3131,  3240,  3350,  3463,  3578,  3694,  3813,  3934,  4057,  4182,  4309,  4438,  4570,  4703,  4838,  4976,
+     5115,  5257,  5401,  5547,  5695,  5845,  5998,  6152,  6309,  6468,  6629,  6792,  6957,  7124,  7294,  7466,
+     7640,  7816,  7994,  8175,  8358,  8543,  8730,  8919,  9111,  9305,  9501,  9699,  9900, 10102, 10307, 10515,
+    10724, 10936, 11150, 11366, 11585, 11806, 12029, 12254, 12482, 12712, 12944, 13179, 13416, 13655, 13896, 14140,
+    14386, 14635, 14885, 15138, 15394, 15652, 15912, 16174, 16439, 16706, 16975, 17247, 17521, 17798, 18077, 18358,
+    18642, 18928, 19216, 19507, 19800, 20095, 20393, 20694, 20996, 21301, 21609, 21919, 22231, 22546, 22863, 23182,
+    23504, 23829, 24156, 24485, 24817, 25151, 25487, 25826, 26168, 26512, 26858, 27207, 27558, 27912, 28268, 28627,
+    28988, 29351, 29717, 30086, 30457, 30830, 31206, 31585, 31966, 32349, 32735, 33124, 33514, 33908, 34304, 34702,
+    35103, 35507, 35913, 36321, 36732, 37146, 37562, 37981, 38402, 38825, 39252, 39680, 40112, 40546, 40982, 41421,
+    41862, 42306, 42753, 43202, 43654, 44108, 44565, 45025, 45487, 45951, 46418, 46888, 47360, 47835, 48313, 48793,
+    49275, 49761, 50249, 50739, 51232, 51728, 52226, 52727, 53230, 53736, 54245, 54756, 55270, 55787, 56306, 56828,
+    57352, 57879, 58409, 58941, 59476, 60014, 60554, 61097, 61642, 62190, 62741, 63295, 63851, 64410, 64971, 65535,
+};
+
+static uint     lcd_slice;
+static uint     lcd_channel;
+static uint16_t lcd_wrap;
+static bool     lcd_gamma_enabled = false;
+
+static volatile uint16_t lcd_level       = 0;  // Current brightness in 8.8 fixed point
+static volatile uint16_t lcd_fade_start  = 0;
+static volatile uint16_t lcd_fade_target = 0;
+static volatile uint32_t lcd_fade_steps  = 0;  // Length of the running fade in PWM periods
+static volatile uint32_t lcd_fade_step   = 0;
+static uint16_t          lcd_fade_ms     = 0;
+
+static uint8_t           lcd_user_level    = 255;  // Level requested by the ESP32, restored when leaving idle
+static volatile uint8_t  lcd_idle_state    = LCD_IDLE_ACTIVE;
+static volatile uint32_t lcd_idle_activity = 0;  // Time of the last input in milliseconds since boot
+static uint32_t          lcd_idle_dim_ms   = 0;
+static uint32_t          lcd_idle_off_ms   = 0;
+static uint8_t           lcd_idle_level    = 0;
+
+static void lcd_apply() {
+    uint8_t  index = lcd_level >> 8;
+    uint32_t duty;
+    if (lcd_gamma_enabled) {
+        // Interpolate between the table entries for fades that move slower than one level per step
+        uint32_t low  = lcd_gamma[index];
+        uint32_t high = lcd_gamma[(index < 255) ? index + 1 : 255];
+        duty          = low + (((high - low) * (lcd_level & 0xFF)) >> 8);
+    } else {
+        duty = ((uint32_t) lcd_level * 65535) / (255 << 8);
+    }
+    pwm_set_chan_level(lcd_slice, lcd_channel, ((uint32_t) lcd_wrap * duty) >> 16);
+}
+
+static void __not_in_flash_func(lcd_pwm_wrap)() {
+    if (!(pwm_get_irq_status_mask() & (1 << lcd_slice))) return;
+    pwm_clear_irq(lcd_slice);
+
+    lcd_fade_step = lcd_fade_step + 1;
+    if (lcd_fade_step >= lcd_fade_steps) {
+        lcd_level = lcd_fade_target;
+        pwm_set_irq_enabled(lcd_slice, false);  // Done, no interrupts until the next fade
+    } else {
+        int32_t delta = (int32_t) lcd_fade_target - (int32_t) lcd_fade_start;
+        lcd_level     = lcd_fade_start + (delta * (int32_t) lcd_fade_step) / (int32_t) lcd_fade_steps;
+    }
+    lcd_apply();
+}
+
+static void lcd_timing() {
+    // The divider and wrap only depend on the system clock, they are recalculated when the clock governor changes it
+    uint32_t clock     = clock_get_hz(clk_sys);
+    uint32_t divider16 = clock / LCD_BACKLIGHT_FREQUENCY / 4096 + (clock % (LCD_BACKLIGHT_FREQUENCY * 4096) != 0);
     if (divider16 / 16 == 0) {
         divider16 = 16;
     }
-    uint32_t wrap = clock * 16 / divider16 / freq - 1;
-    pwm_set_clkdiv_int_frac(slice_num, divider16 / 16, divider16 & 0xF);
-    pwm_set_wrap(slice_num, wrap);
-    pwm_set_chan_level(slice_num, chan, wrap * duty / 255);
-    return wrap;
+    lcd_wrap = clock * 16 / divider16 / LCD_BACKLIGHT_FREQUENCY - 1;
+    pwm_set_clkdiv_int_frac(lcd_slice, divider16 / 16, divider16 & 0xF);
+    pwm_set_wrap(lcd_slice, lcd_wrap);
 }
 
 void lcd_init() {
@@ -33,15 +104,97 @@ void lcd_init() {
     gpio_set_dir(LCD_BACKLIGHT_PIN, true);
     gpio_put(LCD_BACKLIGHT_PIN, false);
     gpio_set_function(LCD_BACKLIGHT_PIN, GPIO_FUNC_PWM);
-    uint slice_num = pwm_gpio_to_slice_num(LCD_BACKLIGHT_PIN);
-    uint chan      = pwm_gpio_to_channel(LCD_BACKLIGHT_PIN);
-    pwm_set_freq_duty(slice_num, chan, 200, 0);
-    pwm_set_enabled(slice_num, true);
-    lcd_backlight(255);
+    lcd_slice   = pwm_gpio_to_slice_num(LCD_BACKLIGHT_PIN);
+    lcd_channel = pwm_gpio_to_channel(LCD_BACKLIGHT_PIN);
+
+    lcd_timing();
+    pwm_set_chan_level(lcd_slice, lcd_channel, 0);
+
+    irq_add_shared_handler(PWM_IRQ_WRAP, lcd_pwm_wrap, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(PWM_IRQ_WRAP, true);
+    pwm_set_enabled(lcd_slice, true);
+    lcd_backlight_fade(255, 0);
+}
+
+void lcd_clock_changed() {
+    uint32_t state = save_and_disable_interrupts();  // The wrap interrupt scales the level with the wrap value
+    lcd_timing();
+    lcd_apply();
+    restore_interrupts(state);
 }
 
 void lcd_backlight(uint8_t value) {
-    uint slice_num = pwm_gpio_to_slice_num(LCD_BACKLIGHT_PIN);
-    uint chan      = pwm_gpio_to_channel(LCD_BACKLIGHT_PIN);
-    pwm_set_freq_duty(slice_num, chan, 200, value);
+    uint32_t state    = save_and_disable_interrupts();  // Button edges restore the level from interrupt context
+    lcd_user_level    = value;
+    lcd_idle_state    = LCD_IDLE_ACTIVE;
+    lcd_idle_activity = to_ms_since_boot(get_absolute_time());
+    lcd_backlight_fade(value, lcd_fade_ms);
+    restore_interrupts(state);
+}
+
+void lcd_backlight_fade(uint8_t value, uint16_t duration_ms) {
+    pwm_set_irq_enabled(lcd_slice, false);
+    pwm_clear_irq(lcd_slice);
+
+    lcd_fade_start  = lcd_level;  // Continue from wherever a running fade got to
+    lcd_fade_target = value << 8;
+    lcd_fade_steps  = ((uint32_t) duration_ms * LCD_BACKLIGHT_FREQUENCY) / 1000;
+    lcd_fade_step   = 0;
+
+    if (lcd_fade_steps == 0) {
+        lcd_level = lcd_fade_target;
+        lcd_apply();
+    } else {
+        pwm_set_irq_enabled(lcd_slice, true);
+    }
+}
+
+void lcd_backlight_configure(uint16_t fade_ms, bool gamma) {
+    pwm_set_irq_enabled(lcd_slice, false);
+    lcd_fade_ms       = fade_ms;
+    lcd_gamma_enabled = gamma;
+    lcd_apply();
+    if (lcd_fade_step < lcd_fade_steps) pwm_set_irq_enabled(lcd_slice, true);
+}
+
+uint8_t lcd_backlight_level() { return lcd_level >> 8; }
+
+bool lcd_backlight_fading() { return lcd_fade_step < lcd_fade_steps; }
+
+void lcd_idle_configure(uint16_t dim_seconds, uint16_t off_seconds, uint8_t dim_level) {
+    uint32_t state  = save_and_disable_interrupts();
+    lcd_idle_dim_ms = dim_seconds * 1000;
+    lcd_idle_off_ms = off_seconds * 1000;
+    lcd_idle_level  = dim_level;
+    restore_interrupts(state);
+    lcd_idle_wake();  // Start counting from the new configuration
+}
+
+void lcd_idle_wake() {
+    uint32_t state    = save_and_disable_interrupts();
+    lcd_idle_activity = to_ms_since_boot(get_absolute_time());
+    if (lcd_idle_state != LCD_IDLE_ACTIVE) {
+        lcd_idle_state = LCD_IDLE_ACTIVE;
+        lcd_backlight_fade(lcd_user_level, 0);  // Wake up instantly, the user is looking at the screen
+    }
+    restore_interrupts(state);
+}
+
+uint8_t lcd_idle_task() {
+    uint32_t state = save_and_disable_interrupts();
+    uint32_t idle  = to_ms_since_boot(get_absolute_time()) - lcd_idle_activity;
+
+    // The off timeout counts from the moment the backlight dimmed, or from the last input when dimming is disabled
+    if ((lcd_idle_state == LCD_IDLE_ACTIVE) && lcd_idle_dim_ms && (idle >= lcd_idle_dim_ms)) {
+        lcd_idle_state = LCD_IDLE_DIMMED;
+        if (lcd_idle_level < lcd_user_level) lcd_backlight_fade(lcd_idle_level, lcd_fade_ms);
+    }
+    if ((lcd_idle_state != LCD_IDLE_OFF) && lcd_idle_off_ms && (idle >= lcd_idle_dim_ms + lcd_idle_off_ms)) {
+        lcd_idle_state = LCD_IDLE_OFF;
+        lcd_backlight_fade(0, lcd_fade_ms);
+    }
+
+    uint8_t idle_state = lcd_idle_state;
+    restore_interrupts(state);
+    return idle_state;
 }
@@ -3,6 +3,23 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+enum {
+    LCD_IDLE_ACTIVE,
+    LCD_IDLE_DIMMED,
+    LCD_IDLE_OFF,
+};
+
 void lcd_init();
+void lcd_clock_changed();  // Recalculates the PWM divider after a system clock change
 void lcd_mode(bool parallel_mode);
-void lcd_backlight(uint8_t value);
+void lcd_backlight(uint8_t value);  // Fade to the level using the configured fade time
+void lcd_backlight_fade(uint8_t value, uint16_t duration_ms);
+void lcd_backlight_configure(uint16_t fade_ms, bool gamma);  // Default fade time, gamma corrected levels instead of linear duty cycles
+
+uint8_t lcd_backlight_level();
+bool    lcd_backlight_fading();
+
+// Idle policy, dims and then switches off the backlight when there is no input
+void    lcd_idle_configure(uint16_t dim_seconds, uint16_t off_seconds, uint8_t dim_level);  // 0 disables a stage
+void    lcd_idle_wake();                                                                     // Restores the backlight, safe to call from interrupt handlers
+uint8_t lcd_idle_task();                                                                     // Returns the idle state
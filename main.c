@@ -4,23 +4,29 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "bsp/board.h"
+#include "analog.h"
+#include "clock_governor.h"
+#include "crash_record.h"
 #include "hardware.h"
-#include "hardware/adc.h"
+#include "hardware/clocks.h"
 #include "hardware/irq.h"
 #include "hardware/pwm.h"
 #include "hardware/structs/watchdog.h"
 #include "hardware/uart.h"
 #include "hardware/watchdog.h"
 #include "i2c_peripheral.h"
+#include "ir.h"
 #include "lcd.h"
-#include "nec_transmit.h"
 #include "pico/bootrom.h"
 #include "pico/stdlib.h"
+#include "profiler.h"
+#include "trace.h"
 #include "tusb.h"
 #include "uart_task.h"
 #include "usb_descriptors.h"
@@ -28,17 +34,30 @@
 #include "ws2812.h"
 
 #ifdef PICO_PANIC_FUNCTION
-#define CRASH_INDICATION_MAGIC 0xFA174200
+const uint32_t* __attribute__((used)) custom_panic_frame;
+
+void __attribute__((used, noreturn)) __printflike(1, 0) custom_panic_record(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    crash_record_panic(custom_panic_frame, fmt, args);
+    va_end(args);
+    crash_record_reboot();
+}
 
-void __attribute__((noreturn)) __printflike(1, 0) custom_panic(const char *fmt, ...) {
-    hw_clear_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_ENABLE_BITS);
-    watchdog_hw->scratch[5] = CRASH_INDICATION_MAGIC;
-    watchdog_hw->scratch[6] = ~CRASH_INDICATION_MAGIC;
-    watchdog_reboot(0, 0, 0);
-    while (1) {
-        tight_loop_contents();
-        asm("");
-    }
+// panic() is a trampoline doing push {lr}; bl custom_panic, remember where that word is before anything else gets pushed
+void __attribute__((naked, noreturn)) custom_panic(const char *fmt, ...) {
+    __asm volatile(
+        ".syntax unified\n"
+        "push {r4, r5}\n"
+        "add r4, sp, #8\n"
+        "ldr r5, =custom_panic_frame\n"
+        "str r4, [r5]\n"
+        "ldr r4, =custom_panic_record\n"
+        "mov r12, r4\n"
+        "pop {r4, r5}\n"
+        "bx r12\n"
+        ".align 2\n"
+        ".ltorg\n");
 }
 
 void check_crashed() {
@@ -50,6 +69,13 @@ void check_crashed() { i2c_set_crash_debug_state(false, true); }
 #endif
 
 int main(void) {
+#ifdef UART_EXACT_BAUD_CLOCK
+    // Before anything derives a divider from the clock, the clock governor then gives clk_peri the same rate for the UARTs
+    set_sys_clock_khz(UART_EXACT_BAUD_CLOCK_KHZ, true);
+#endif
+    clock_governor_init();
+    crash_record_init();
+    profiler_init();
     board_init();
     tusb_init();
     setup_uart();
@@ -57,16 +83,13 @@ int main(void) {
     gpio_init(BATT_CHRG_PIN);
     gpio_set_dir(BATT_CHRG_PIN, false);
 
-    adc_init();
-    adc_gpio_init(ANALOG_VBAT_PIN);
-    adc_gpio_init(ANALOG_VUSB_PIN);
+    analog_init();
 
-    int ir_statemachine = nec_tx_init(IR_PIO, IR_PIN);
-    if (ir_statemachine < 0) panic("Failed to init IR");
+    if (!ir_init()) panic("Failed to init IR");
 
     lcd_init();
 
-    setup_i2c_registers(ir_statemachine);
+    setup_i2c_registers();
     check_crashed();  // Populate the crash & debug state register
     setup_i2c_peripheral(I2C_SYSTEM, I2C_SYSTEM_SDA_PIN, I2C_SYSTEM_SCL_PIN, 0x17, 400000, i2c_slave_handler);
     esp32_reset(false);  // Reset ESP32 to normal mode
@@ -74,23 +97,49 @@ int main(void) {
     ws2812_setup();
 
     while (1) {
+        profiler_loop();
+        crash_record_task(CRASH_TASK_TUD);
+        profiler_task(PROFILER_TASK_TUD);
         tud_task();
+        crash_record_task(CRASH_TASK_UART);
+        profiler_task(PROFILER_TASK_UART);
         uart_task();
+        crash_record_task(CRASH_TASK_I2C);
+        profiler_task(PROFILER_TASK_I2C);
         i2c_task();
+        crash_record_task(CRASH_TASK_WEBUSB);
+        profiler_task(PROFILER_TASK_WEBUSB);
         webusb_task();
+        crash_record_task(CRASH_TASK_TRACE);
+        profiler_task(PROFILER_TASK_TRACE);
+        trace_task();
     }
 
     return 0;
 }
 
 // Invoked when device is mounted
-void tud_mount_cb(void) { i2c_usb_set_mounted(true); }
+void tud_mount_cb(void) {
+    trace_event(TRACE_EVENT_USB_MOUNT, true, 0);
+    i2c_usb_set_mounted(true);
+}
 
 // Invoked when device is unmounted
-void tud_umount_cb(void) { i2c_usb_set_mounted(false); }
+void tud_umount_cb(void) {
+    trace_event(TRACE_EVENT_USB_MOUNT, false, 0);
+    i2c_usb_set_mounted(false);
+}
 
 // Invoked when usb bus is suspended
-void tud_suspend_cb(bool remote_wakeup_en) { i2c_usb_set_suspended(true, remote_wakeup_en); }
+void tud_suspend_cb(bool remote_wakeup_en) {
+    trace_event(TRACE_EVENT_USB_SUSPEND, true, remote_wakeup_en);
+    i2c_usb_set_suspended(true, remote_wakeup_en);
+    clock_governor_usb_suspended(true);
+}
 
 // Invoked when usb bus is resumed
-void tud_resume_cb(void) { i2c_usb_set_suspended(false, false); }
+void tud_resume_cb(void) {
+    trace_event(TRACE_EVENT_USB_SUSPEND, false, 0);
+    i2c_usb_set_suspended(false, false);
+    clock_governor_usb_suspended(false);
+}
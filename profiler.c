@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "pico/stdlib.h"
+
+#define PROFILER_SYSTICK_MASK 0x00FFFFFF  // 24-bit down counter, wraps after 134 ms at 125 MHz
+
+static profiler_stats_t profiler_stats;
+static profiler_stats_t profiler_stats_copy;
+static uint32_t         profiler_reset_us;
+static uint32_t         profiler_reference_hz;     // clk_sys at init, cycle counts are scaled to it
+static uint32_t         profiler_scale = 1 << 16;  // Reference cycles per clk_sys cycle in 16.16 fixed point
+
+static bool     profiler_running     = false;  // A task measurement is in progress
+static uint8_t  profiler_active_task = 0;
+static uint32_t profiler_task_cycles;
+static uint32_t profiler_task_us;
+static bool     profiler_looping = false;
+static uint32_t profiler_loop_cycles;
+static uint32_t profiler_loop_us;
+
+static void profiler_clear() {
+    memset(&profiler_stats, 0, sizeof(profiler_stats));
+    profiler_stats.loop.min_cycles = UINT32_MAX;
+    for (uint8_t task = 0; task < PROFILER_TASKS; task++) profiler_stats.tasks[task].min_cycles = UINT32_MAX;
+    xip_ctrl_hw->ctr_hit = 0;  // Any write clears the counter
+    xip_ctrl_hw->ctr_acc = 0;
+    profiler_reset_us    = time_us_32();
+}
+
+static void profiler_record(profiler_timing_t* timing, uint32_t start_cycles, uint32_t start_us, uint32_t now_cycles, uint32_t now_us) {
+    uint32_t elapsed_us = now_us - start_us;
+    uint32_t cycles     = ((uint64_t) ((start_cycles - now_cycles) & PROFILER_SYSTICK_MASK) * profiler_scale) >> 16;
+    if (elapsed_us >= 100000) cycles = elapsed_us * (profiler_reference_hz / 1000000);  // SysTick may have wrapped, fall back to the timer
+    uint8_t bucket = (elapsed_us > 1) ? (31 - __builtin_clz(elapsed_us)) : 0;
+    if (bucket >= PROFILER_HISTOGRAM_BUCKETS) bucket = PROFILER_HISTOGRAM_BUCKETS - 1;
+    timing->count++;
+    timing->total_cycles += cycles;
+    if (cycles < timing->min_cycles) timing->min_cycles = cycles;
+    if (cycles > timing->max_cycles) timing->max_cycles = cycles;
+    timing->histogram[bucket]++;
+}
+
+static void profiler_task_end(uint32_t now_cycles, uint32_t now_us) {
+    if (profiler_running) profiler_record(&profiler_stats.tasks[profiler_active_task], profiler_task_cycles, profiler_task_us, now_cycles, now_us);
+    profiler_running = false;
+}
+
+void profiler_init() {
+    // SysTick free running from the processor clock, no interrupt
+    systick_hw->csr = 0;
+    systick_hw->rvr = PROFILER_SYSTICK_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+    profiler_reference_hz = clock_get_hz(clk_sys);
+    profiler_clear();
+}
+
+void profiler_clock_changed() {
+    // The clock governor changes clk_sys at runtime, samples keep counting in reference cycles so they stay comparable
+    profiler_scale = ((uint64_t) profiler_reference_hz << 16) / clock_get_hz(clk_sys);
+}
+
+void profiler_loop() {
+    uint32_t now_cycles = systick_hw->cvr;
+    uint32_t now_us     = time_us_32();
+    profiler_task_end(now_cycles, now_us);
+    if (profiler_looping) profiler_record(&profiler_stats.loop, profiler_loop_cycles, profiler_loop_us, now_cycles, now_us);
+    profiler_looping     = true;
+    profiler_loop_cycles = now_cycles;
+    profiler_loop_us     = now_us;
+}
+
+void profiler_task(uint8_t task) {
+    uint32_t now_cycles = systick_hw->cvr;
+    uint32_t now_us     = time_us_32();
+    profiler_task_end(now_cycles, now_us);
+    profiler_running     = true;
+    profiler_active_task = task;
+    profiler_task_cycles = now_cycles;
+    profiler_task_us     = now_us;
+}
+
+const profiler_stats_t* profiler_snapshot(bool reset) {
+    // Only the superloop updates the counters, the vendor request is handled from it as well
+    profiler_stats.clock        = profiler_reference_hz;
+    profiler_stats.elapsed_us   = time_us_32() - profiler_reset_us;
+    profiler_stats.xip_hits     = xip_ctrl_hw->ctr_hit;
+    profiler_stats.xip_accesses = xip_ctrl_hw->ctr_acc;
+    memcpy(&profiler_stats_copy, &profiler_stats, sizeof(profiler_stats_t));
+    if (reset) profiler_clear();
+    return &profiler_stats_copy;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Superloop tasks, in the order main() runs them
+enum { PROFILER_TASK_TUD, PROFILER_TASK_UART, PROFILER_TASK_I2C, PROFILER_TASK_WEBUSB, PROFILER_TASK_TRACE, PROFILER_TASKS };
+
+#define PROFILER_HISTOGRAM_BUCKETS 16
+
+typedef struct __attribute__((packed)) {
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;                           // Average is total_cycles / count
+    uint32_t histogram[PROFILER_HISTOGRAM_BUCKETS];  // Bucket n counts [2^n, 2^(n+1)) us
+} profiler_timing_t;
+
+// As returned by the get profile vendor request
+typedef struct __attribute__((packed)) {
+    uint32_t          clock;       // Reference clock in Hz that all cycle counts are scaled to, converts cycles to time
+    uint32_t          elapsed_us;  // Since the counters were reset
+    profiler_timing_t loop;        // Whole superloop iterations
+    profiler_timing_t tasks[PROFILER_TASKS];
+    uint32_t          xip_hits;  // XIP cache, accesses minus hits are the misses that stalled on flash
+    uint32_t          xip_accesses;
+} profiler_stats_t;
+
+void profiler_init();
+void profiler_loop();              // Start of a superloop iteration
+void profiler_task(uint8_t task);  // Start of a task, ends the previous one
+void profiler_clock_changed();     // clk_sys changed, later samples are scaled to the reference clock
+
+const profiler_stats_t* profiler_snapshot(bool reset);  // Stays valid until the next call
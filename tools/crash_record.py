@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nicolai Electronics
+# SPDX-License-Identifier: MIT
+#
+# Reads the crash record the RP2040 kept from before its last reboot, needs pyusb (pip install pyusb)
+#
+# Examples:
+#   python3 tools/crash_record.py
+#   python3 tools/crash_record.py --clear
+
+import argparse
+import struct
+import sys
+
+import usb.core
+
+USB_VID = 0x16D0
+USB_PID = 0x0F9A
+
+INTERFACE = 4  # ESP32 vendor interface, the request is answered on both
+
+REQUEST_GET_CRASH_RECORD = 0x37
+REQUEST_CLEAR_CRASH_RECORD = 0x38
+
+STACK_WORDS = 16
+MESSAGE_SIZE = 64
+RECORD_FORMAT = f"<IBBBBIIIII{STACK_WORDS}I{MESSAGE_SIZE}sI"
+
+TYPES = {1: "panic", 2: "HardFault"}
+TASKS = {0: "init", 1: "tud_task", 2: "uart_task", 3: "i2c_task", 4: "webusb_task", 5: "trace_task"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read the RP2040 crash record")
+    parser.add_argument("--clear", action="store_true", help="discard the record after reading it")
+    args = parser.parse_args()
+
+    device = usb.core.find(idVendor=USB_VID, idProduct=USB_PID)
+    if device is None:
+        sys.exit("Device not found")
+
+    data = bytes(device.ctrl_transfer(0xA1, REQUEST_GET_CRASH_RECORD, 0, INTERFACE, struct.calcsize(RECORD_FORMAT)))
+    if len(data) == 0:
+        print("No crash record")
+        return
+    fields = struct.unpack(RECORD_FORMAT, data)
+    magic, version, kind, task, _, uptime_ms, pc, lr, sp, xpsr = fields[:10]
+    stack = fields[10 : 10 + STACK_WORDS]
+    message = fields[10 + STACK_WORDS].split(b"\0")[0].decode(errors="replace")
+    checksum = fields[11 + STACK_WORDS]
+    expected = sum(struct.unpack(f"<{(len(data) - 4) // 4}I", data[:-4])) & 0xFFFFFFFF
+
+    print(f"Type:    {TYPES.get(kind, kind)} (record version {version}{'' if checksum == expected else ', checksum mismatch'})")
+    print(f"Message: {message}")
+    print(f"Task:    {TASKS.get(task, task)}")
+    print(f"Uptime:  {uptime_ms / 1000:.3f} s")
+    print(f"PC:      0x{pc:08x}  LR: 0x{lr:08x}  xPSR: 0x{xpsr:08x}")
+    print(f"Stack at 0x{sp:08x}:")
+    for index in range(0, STACK_WORDS, 4):
+        print("  " + " ".join(f"{word:08x}" for word in stack[index : index + 4]))
+
+    if args.clear:
+        device.ctrl_transfer(0x21, REQUEST_CLEAR_CRASH_RECORD, 0, INTERFACE)
+
+
+if __name__ == "__main__":
+    main()
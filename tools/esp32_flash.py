@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nicolai Electronics
+# SPDX-License-Identifier: MIT
+#
+# Flashes the ESP32 through the ROM loader client on the RP2040, needs pyusb (pip install pyusb)
+#
+# The image is deflate compressed here and streamed over the ESP32 WebUSB interface, the RP2040 resets the ESP32 into
+# its ROM loader and does the sync, baud rate switch, block writes and MD5 verification on its own.
+#
+# Example:
+#   python3 tools/esp32_flash.py 0x10000 build/app.bin --baudrate 2000000
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+import zlib
+
+import usb.core
+import usb.util
+
+USB_VID = 0x16D0
+USB_PID = 0x0F9A
+
+INTERFACE = 4  # ESP32 WebUSB interface
+ENDPOINT_OUT = 0x05
+
+REQUEST_START = 0x33
+REQUEST_STATUS = 0x34
+REQUEST_ABORT = 0x35
+
+START_FORMAT = "<IIIII16s"  # offset, size, compressed size, flash size, baud rate, MD5 of the image
+STATUS_FORMAT = "<BBBBIII"  # state, error, ROM status, ROM error, received, blocks written, blocks total
+
+STATES = ["idle", "reset", "sync", "attach", "parameters", "baudrate", "baudrate settle", "begin", "data", "verify", "done", "failed"]
+ERRORS = ["ok", "no sync", "timeout", "rejected by the ROM", "MD5 mismatch", "aborted"]
+STATE_DONE = 10
+STATE_FAILED = 11
+
+
+def get_status(device):
+    data = device.ctrl_transfer(0xA1, REQUEST_STATUS, 0, INTERFACE, struct.calcsize(STATUS_FORMAT))
+    state, error, rom_status, rom_error, received, written, total = struct.unpack(STATUS_FORMAT, bytes(data))
+    return {"state": state, "error": error, "rom_status": rom_status, "rom_error": rom_error, "received": received, "written": written,
+            "total": total}
+
+
+def progress(status):
+    print(f"\r{STATES[status['state']]:>16}: block {status['written']}/{status['total']}", end="", flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flash the MCH2022 badge ESP32 through the RP2040")
+    parser.add_argument("offset", type=lambda value: int(value, 0), help="flash address")
+    parser.add_argument("image")
+    parser.add_argument("--baudrate", type=int, default=2000000, help="ESP32 UART rate while flashing")
+    parser.add_argument("--flash-size", type=lambda value: int(value, 0), default=16 * 1024 * 1024)
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as file:
+        image = file.read()
+    # Like esptool, the flash writes and the MD5 check work on whole words
+    image += b"\xff" * (-len(image) % 4)
+    compressed = zlib.compress(image, 9)
+    print(f"{len(image)} bytes, {len(compressed)} compressed")
+
+    device = usb.core.find(idVendor=USB_VID, idProduct=USB_PID)
+    if device is None:
+        sys.exit("Badge not found")
+    if device.is_kernel_driver_active(INTERFACE):
+        device.detach_kernel_driver(INTERFACE)
+    usb.util.claim_interface(device, INTERFACE)
+
+    start = time.monotonic()
+    try:
+        device.ctrl_transfer(0x21, REQUEST_START, 0, INTERFACE,
+                             struct.pack(START_FORMAT, args.offset, len(image), len(compressed), args.flash_size, args.baudrate,
+                                         hashlib.md5(image).digest()))
+        # The RP2040 only takes the next block once the ROM wrote the previous one, erasing can take a while before the first
+        for position in range(0, len(compressed), 4096):
+            try:
+                device.write(ENDPOINT_OUT, compressed[position:position + 4096], timeout=120000)
+            except usb.core.USBTimeoutError:
+                break
+            progress(get_status(device))
+
+        status = get_status(device)
+        while status["state"] not in (STATE_DONE, STATE_FAILED):
+            time.sleep(0.1)
+            status = get_status(device)
+            progress(status)
+        print()
+    except KeyboardInterrupt:
+        device.ctrl_transfer(0x21, REQUEST_ABORT, 0, INTERFACE)
+        raise
+    finally:
+        usb.util.release_interface(device, INTERFACE)
+
+    if status["state"] == STATE_FAILED:
+        detail = f" (status {status['rom_status']}, error {status['rom_error']})" if status["rom_status"] else ""
+        sys.exit(f"Failed: {ERRORS[status['error']]}{detail}")
+    print(f"Done in {time.monotonic() - start:.1f} s, MD5 verified")
+
+
+if __name__ == "__main__":
+    main()
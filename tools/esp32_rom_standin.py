@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nicolai Electronics
+# SPDX-License-Identifier: MIT
+#
+# Stand-in for the ESP32 ROM loader, for testing the flashing path on Linux without an ESP32, needs pyserial
+#
+# Implements the commands the RP2040 loader client uses (sync, SPI attach, SPI parameters, baud rate change, deflate
+# begin/data/end and MD5) plus register reads for chip detection. Written data ends up in a flash image file.
+#
+# Examples:
+#   python3 tools/esp32_rom_standin.py --port /dev/ttyUSB0    # USB serial adapter wired to the badge ESP32 UART pins
+#   python3 tools/esp32_rom_standin.py --pty                  # Prints a pseudo terminal to point esptool or tests at
+
+import argparse
+import hashlib
+import os
+import select
+import struct
+import sys
+import tty
+import zlib
+
+import serial
+
+SLIP_END = 0xC0
+SLIP_ESC = 0xDB
+
+FLASH_DEFL_BEGIN = 0x10
+FLASH_DEFL_DATA = 0x11
+FLASH_DEFL_END = 0x12
+SYNC = 0x08
+READ_REG = 0x0A
+SPI_SET_PARAMS = 0x0B
+SPI_ATTACH = 0x0D
+CHANGE_BAUDRATE = 0x0F
+SPI_FLASH_MD5 = 0x13
+
+CHIP_DETECT_MAGIC_REG = 0x40001000
+ESP32_MAGIC = 0x00F01D83
+
+ERROR_INVALID_MESSAGE = 0x05
+ERROR_BAD_CHECKSUM = 0x07
+ERROR_BAD_SEQUENCE = 0x08
+ERROR_INFLATE = 0x0B
+
+
+class PtyPort:
+    # Controller side of a pseudo terminal, the baud rate has no effect there
+    def __init__(self, fd):
+        self.fd = fd
+        self.baudrate = 115200
+
+    def read(self, size):
+        readable, _, _ = select.select([self.fd], [], [], 0.1)
+        return os.read(self.fd, size) if readable else b""
+
+    def write(self, data):
+        os.write(self.fd, data)
+
+    def flush(self):
+        pass
+
+
+def slip_frames(port):
+    frame = None
+    escape = False
+    while True:
+        data = port.read(1)
+        if not data:
+            continue
+        byte = data[0]
+        if byte == SLIP_END:
+            if frame:
+                yield bytes(frame)
+            frame = bytearray()
+        elif frame is None:
+            continue  # Not inside a frame yet
+        elif escape:
+            frame.append({0xDC: SLIP_END, 0xDD: SLIP_ESC}.get(byte, byte))
+            escape = False
+        elif byte == SLIP_ESC:
+            escape = True
+        else:
+            frame.append(byte)
+
+
+class RomLoader:
+    def __init__(self, port, flash, verbose):
+        self.port = port
+        self.flash = flash
+        self.verbose = verbose
+        self.write = None  # Offset, size, expected blocks, next sequence number, decompressor
+
+    def respond(self, command, value=0, data=b"", error=0):
+        status = bytes([1 if error else 0, error, 0, 0])
+        body = struct.pack("<BBHI", 0x01, command, len(data) + len(status), value) + data + status
+        encoded = body.replace(b"\xdb", b"\xdb\xdd").replace(b"\xc0", b"\xdb\xdc")
+        self.port.write(b"\xc0" + encoded + b"\xc0")
+
+    def handle(self, frame):
+        if len(frame) < 8 or frame[0] != 0x00:
+            return
+        command, size, checksum = struct.unpack_from("<BHI", frame, 1)
+        data = frame[8:]
+        if len(data) != size:
+            return self.respond(command, error=ERROR_INVALID_MESSAGE)
+        if self.verbose:
+            print(f"command 0x{command:02x}, {size} bytes")
+
+        if command == SYNC:
+            for _ in range(8):  # The ROM answers a sync several times
+                self.respond(command)
+        elif command == READ_REG:
+            (address,) = struct.unpack_from("<I", data)
+            self.respond(command, ESP32_MAGIC if address == CHIP_DETECT_MAGIC_REG else 0)
+        elif command in (SPI_ATTACH, SPI_SET_PARAMS):
+            self.respond(command)
+        elif command == CHANGE_BAUDRATE:
+            (baudrate,) = struct.unpack_from("<I", data)
+            self.respond(command)
+            self.port.flush()
+            self.port.baudrate = baudrate
+            print(f"Switched to {baudrate} baud")
+        elif command == FLASH_DEFL_BEGIN:
+            size, blocks, block_size, offset = struct.unpack_from("<IIII", data)
+            if offset + size > len(self.flash):
+                return self.respond(command, error=ERROR_INVALID_MESSAGE)
+            self.write = {"offset": offset, "position": offset, "end": offset + size, "blocks": blocks, "sequence": 0,
+                          "inflate": zlib.decompressobj()}
+            self.flash[offset:offset + size] = b"\xff" * size
+            print(f"Writing {size} bytes at 0x{offset:x} in {blocks} blocks")
+            self.respond(command)
+        elif command == FLASH_DEFL_DATA:
+            length, sequence = struct.unpack_from("<II", data)
+            block = data[16:16 + length]
+            expected = 0xEF
+            for byte in block:
+                expected ^= byte
+            if self.write is None or length != len(block) or checksum != expected:
+                return self.respond(command, error=ERROR_BAD_CHECKSUM)
+            if sequence != self.write["sequence"]:
+                return self.respond(command, error=ERROR_BAD_SEQUENCE)
+            try:
+                output = self.write["inflate"].decompress(block)
+            except zlib.error:
+                return self.respond(command, error=ERROR_INFLATE)
+            position = self.write["position"]
+            if position + len(output) > self.write["end"]:
+                return self.respond(command, error=ERROR_INFLATE)
+            self.flash[position:position + len(output)] = output
+            self.write["position"] += len(output)
+            self.write["sequence"] += 1
+            self.respond(command)
+        elif command == FLASH_DEFL_END:
+            self.write = None
+            self.respond(command)
+        elif command == SPI_FLASH_MD5:
+            address, size = struct.unpack_from("<II", data)
+            digest = hashlib.md5(self.flash[address:address + size]).hexdigest().encode()
+            print(f"MD5 of {size} bytes at 0x{address:x}: {digest.decode()}")
+            self.respond(command, data=digest)
+        else:
+            self.respond(command, error=ERROR_INVALID_MESSAGE)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Stand-in for the ESP32 ROM loader")
+    group = parser.add_mutually_exclusive_group(required=True)
+    group.add_argument("--port", help="serial port")
+    group.add_argument("--pty", action="store_true", help="create a pseudo terminal")
+    parser.add_argument("--flash", default="esp32_flash.bin", help="flash image file, created when missing")
+    parser.add_argument("--flash-size", type=lambda value: int(value, 0), default=16 * 1024 * 1024)
+    parser.add_argument("--verbose", action="store_true")
+    args = parser.parse_args()
+
+    flash = bytearray(b"\xff" * args.flash_size)
+    if os.path.exists(args.flash):
+        with open(args.flash, "rb") as file:
+            content = file.read(args.flash_size)
+        flash[:len(content)] = content
+
+    if args.pty:
+        controller, peripheral = os.openpty()
+        tty.setraw(peripheral)
+        print(f"ROM loader stand-in on {os.ttyname(peripheral)}")
+        port = PtyPort(controller)
+    else:
+        port = serial.Serial(args.port, 115200, timeout=0.1)
+
+    loader = RomLoader(port, flash, args.verbose)
+    try:
+        for frame in slip_frames(port):
+            loader.handle(frame)
+            if len(frame) > 1 and frame[1] in (SPI_FLASH_MD5, FLASH_DEFL_END):
+                with open(args.flash, "wb") as file:
+                    file.write(flash)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nicolai Electronics
+# SPDX-License-Identifier: MIT
+#
+# Reads the superloop profile of the RP2040 firmware, needs pyusb (pip install pyusb)
+#
+# Examples:
+#   python3 tools/superloop_profile.py
+#   python3 tools/superloop_profile.py --reset --interval 5
+
+import argparse
+import struct
+import sys
+import time
+
+import usb.core
+
+USB_VID = 0x16D0
+USB_PID = 0x0F9A
+
+INTERFACE = 4  # ESP32 vendor interface, the request is answered on both
+
+REQUEST_GET_PROFILE = 0x39
+
+TASKS = ["tud_task", "uart_task", "i2c_task", "webusb_task", "trace_task"]
+BUCKETS = 16
+TIMING_FORMAT = f"IIIQ{BUCKETS}I"  # count, min, max, total cycles, histogram
+PROFILE_FORMAT = "<II" + TIMING_FORMAT * (1 + len(TASKS)) + "II"
+
+
+def get_profile(device, reset):
+    data = bytes(device.ctrl_transfer(0xA1, REQUEST_GET_PROFILE, 1 if reset else 0, INTERFACE, struct.calcsize(PROFILE_FORMAT)))
+    fields = struct.unpack(PROFILE_FORMAT, data)
+    clock, elapsed_us = fields[:2]
+    timings = []
+    for index in range(1 + len(TASKS)):
+        offset = 2 + index * (4 + BUCKETS)
+        count, minimum, maximum, total = fields[offset : offset + 4]
+        timings.append((count, minimum, maximum, total, fields[offset + 4 : offset + 4 + BUCKETS]))
+    return clock, elapsed_us, timings, fields[-2], fields[-1]
+
+
+def report(clock, elapsed_us, timings, xip_hits, xip_accesses):
+    print(f"{elapsed_us / 1e6:.2f} s, cycles counted at {clock / 1e6:.1f} MHz")
+    print(f"{'':12} {'count':>10} {'min us':>9} {'avg us':>9} {'max us':>9} {'share':>6}  histogram (log2 us)")
+    for name, (count, minimum, maximum, total, histogram) in zip(["loop"] + TASKS, timings):
+        if count == 0:
+            print(f"{name:12} {0:10}")
+            continue
+        share = total / clock * 1e6 / elapsed_us * 100 if elapsed_us else 0
+        last = max(index for index, value in enumerate(histogram) if value) + 1
+        print(f"{name:12} {count:10} {minimum / clock * 1e6:9.2f} {total / count / clock * 1e6:9.2f} {maximum / clock * 1e6:9.2f} {share:5.1f}%  {' '.join(str(value) for value in histogram[:last])}")
+    if xip_accesses:
+        print(f"XIP cache: {xip_hits} of {xip_accesses} accesses hit ({xip_hits / xip_accesses * 100:.2f}%), {xip_accesses - xip_hits} misses")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read the RP2040 superloop profile")
+    parser.add_argument("--reset", action="store_true", help="reset the counters first and measure for the interval")
+    parser.add_argument("--interval", type=float, default=1.0, help="measurement time in seconds after a reset")
+    args = parser.parse_args()
+
+    device = usb.core.find(idVendor=USB_VID, idProduct=USB_PID)
+    if device is None:
+        sys.exit("Device not found")
+
+    if args.reset:
+        get_profile(device, True)
+        time.sleep(args.interval)
+    report(*get_profile(device, False))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nicolai Electronics
+# SPDX-License-Identifier: MIT
+#
+# Decodes the binary trace stream of the RP2040 trace CDC interface, needs pyserial (pip install pyserial) for live capture
+#
+# Examples:
+#   python3 tools/trace_decode.py /dev/ttyACM2
+#   python3 tools/trace_decode.py /dev/ttyACM2 --stats --save trace.bin
+#   python3 tools/trace_decode.py --file trace.bin
+
+import argparse
+import struct
+import sys
+
+RECORD_FORMAT = "<IBBH"  # time in microseconds, event, a, b
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+SYNC_MAGIC = 0x5AA5
+
+STATS_FORMAT = "<7IHH16I"
+STATS_FIELDS = ["rx_bytes", "tx_bytes", "rx_dropped", "overrun_errors", "framing_errors", "parity_errors", "break_errors", "rx_ring_high", "usb_fifo_high"]
+
+PORTS = ["esp32", "fpga"]
+CDCS = ["esp32", "fpga", "trace"]
+LEVELS = ["boost", "normal", "idle"]
+
+
+def i2c(a, b):
+    return f"register {a}, value 0x{b:02x}"
+
+
+EVENTS = {
+    0: ("sync", lambda a, b: ""),
+    1: ("lost", lambda a, b: f"{b} events"),
+    2: ("stats", lambda a, b: PORTS[a] if a < len(PORTS) else a),
+    3: ("i2c address", lambda a, b: f"register {a}"),
+    4: ("i2c write", i2c),
+    5: ("i2c read", i2c),
+    6: ("uart rx", lambda a, b: f"{PORTS[a]} {b} bytes"),
+    7: ("uart tx", lambda a, b: f"{PORTS[a]} {b} bytes"),
+    8: ("uart dropped", lambda a, b: f"{PORTS[a]} {b} bytes"),
+    9: ("usb mount", lambda a, b: "mounted" if a else "unmounted"),
+    10: ("usb suspend", lambda a, b: ("suspended, remote wakeup " + ("on" if b else "off")) if a else "resumed"),
+    11: ("line coding", lambda a, b: f"{CDCS[a] if a < len(CDCS) else a} {b * 100} baud"),
+    12: ("line state", lambda a, b: f"{CDCS[a] if a < len(CDCS) else a} dtr {b & 1} rts {(b >> 1) & 1}"),
+    13: ("vendor request", lambda a, b: f"0x{a:02x} wValue 0x{b:04x}"),
+    14: ("esp32 reset", lambda a, b: "download mode" if a else "normal"),
+    15: ("clock", lambda a, b: f"{LEVELS[a] if a < len(LEVELS) else a} {b} MHz"),
+}
+
+
+class Decoder:
+    def __init__(self):
+        self.buffer = b""
+        self.synced = False
+
+    def feed(self, data):
+        self.buffer += data
+        while True:
+            if not self.synced:
+                # The stream starts with a sync record once the port is opened, skip anything before it
+                sync = struct.pack("<BBH", 0, 0, SYNC_MAGIC)
+                index = self.buffer.find(sync, 4)
+                if index < 0:
+                    self.buffer = self.buffer[-(RECORD_SIZE - 1) :]
+                    return
+                self.buffer = self.buffer[index - 4 :]
+                self.synced = True
+            if len(self.buffer) < RECORD_SIZE:
+                return
+            time_us, event, a, b = struct.unpack(RECORD_FORMAT, self.buffer[:RECORD_SIZE])
+            if event == 2 and len(self.buffer) < RECORD_SIZE + b:
+                return
+            self.buffer = self.buffer[RECORD_SIZE:]
+            name, describe = EVENTS.get(event, (f"event {event}", lambda a, b: f"{a} {b}"))
+            print(f"{time_us / 1e6:12.6f}  {name:15} {describe(a, b)}")  # Seconds since boot, wraps after 71 minutes
+            if event == 2:
+                self.stats(self.buffer[:b])
+                self.buffer = self.buffer[b:]
+
+    def stats(self, data):
+        values = struct.unpack(STATS_FORMAT, data[: struct.calcsize(STATS_FORMAT)])
+        for name, value in zip(STATS_FIELDS, values):
+            print(f"{'':30}{name}: {value}")
+        latency = values[len(STATS_FIELDS) :]
+        print(f"{'':30}latency (log2 us): {' '.join(str(count) for count in latency)}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode the RP2040 binary trace stream")
+    parser.add_argument("port", nargs="?", help="serial device of the trace CDC interface")
+    parser.add_argument("--file", help="decode a saved stream instead of a serial device")
+    parser.add_argument("--save", help="also write the raw stream to this file")
+    parser.add_argument("--stats", action="store_true", help="request the port statistics")
+    parser.add_argument("--reset-stats", action="store_true", help="request the port statistics and reset them")
+    args = parser.parse_args()
+
+    decoder = Decoder()
+    if args.file:
+        with open(args.file, "rb") as stream:
+            decoder.feed(stream.read())
+        return
+    if not args.port:
+        parser.error("either a serial device or --file is needed")
+
+    import serial
+
+    save = open(args.save, "wb") if args.save else None
+    with serial.Serial(args.port, timeout=0.1) as port:  # Opening the port raises DTR, the firmware starts with a sync record
+        if args.stats or args.reset_stats:
+            port.write(b"S" if args.reset_stats else b"s")
+        try:
+            while True:
+                data = port.read(4096)
+                if save:
+                    save.write(data)
+                decoder.feed(data)
+        except KeyboardInterrupt:
+            pass
+    if save:
+        save.close()
+
+
+if __name__ == "__main__":
+    main()
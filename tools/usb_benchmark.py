@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nicolai Electronics
+# SPDX-License-Identifier: MIT
+#
+# USB throughput benchmark for the RP2040 WebUSB interfaces, needs pyusb (pip install pyusb)
+#
+# Examples:
+#   python3 tools/usb_benchmark.py source
+#   python3 tools/usb_benchmark.py loopback --interface fpga --duration 10
+
+import argparse
+import struct
+import sys
+import time
+
+import usb.core
+import usb.util
+
+USB_VID = 0x16D0
+USB_PID = 0x0F9A
+
+# Vendor interface number, OUT endpoint and IN endpoint per bridge
+INTERFACES = {"esp32": (4, 0x05, 0x85), "fpga": (5, 0x06, 0x86)}
+
+MODES = {"off": 0, "source": 1, "sink": 2, "loopback": 3}
+
+REQUEST_SET_BENCHMARK = 0x29
+REQUEST_GET_BENCHMARK = 0x2A
+
+RECORD_SIZE = 64
+RESULTS_FORMAT = "<BIIIIII"  # mode, records, bytes, dropped, sequence, elapsed in microseconds, reordered
+
+
+def set_mode(device, interface, mode):
+    device.ctrl_transfer(0x21, REQUEST_SET_BENCHMARK, MODES[mode], interface)
+
+
+def get_results(device, interface):
+    data = device.ctrl_transfer(0xA1, REQUEST_GET_BENCHMARK, 0, interface, struct.calcsize(RESULTS_FORMAT))
+    mode, records, length, dropped, sequence, elapsed, reordered = struct.unpack(RESULTS_FORMAT, bytes(data))
+    return {"records": records, "bytes": length, "dropped": dropped, "sequence": sequence, "elapsed": elapsed / 1e6, "reordered": reordered}
+
+
+def gap(sequence, expected):
+    # Sequence numbers skipped before this record, negative when it was repeated or arrived out of order
+    difference = (sequence - expected) & 0xFFFFFFFF
+    return difference - 0x100000000 if difference & 0x80000000 else difference
+
+
+def record(sequence):
+    # Sequence number and host timestamp, the timestamp is echoed back in loopback mode
+    return struct.pack("<IQ", sequence & 0xFFFFFFFF, time.perf_counter_ns()).ljust(RECORD_SIZE, b"\0")
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def report(name, length, elapsed):
+    print(f"{name}: {length} bytes in {elapsed:.2f} s, {length / elapsed / 1e6:.3f} MB/s")
+
+
+def run_source(device, endpoint_in, duration):
+    received = 0
+    expected = None
+    dropped = 0
+    reordered = 0
+    start = time.monotonic()
+    while time.monotonic() - start < duration:
+        data = bytes(device.read(endpoint_in, 4096, timeout=1000))
+        received += len(data)
+        for offset in range(0, len(data) - RECORD_SIZE + 1, RECORD_SIZE):
+            (sequence,) = struct.unpack_from("<I", data, offset)
+            if expected is not None and gap(sequence, expected) < 0:
+                reordered += 1
+                continue
+            if expected is not None:
+                dropped += gap(sequence, expected)
+            expected = (sequence + 1) & 0xFFFFFFFF
+    report("Source (badge to host)", received, time.monotonic() - start)
+    print(f"Dropped sequence numbers: {dropped}, reordered records: {reordered}")
+
+
+def run_sink(device, endpoint_out, duration):
+    sent = 0
+    sequence = 0
+    start = time.monotonic()
+    while time.monotonic() - start < duration:
+        chunk = b"".join(record(sequence + index) for index in range(64))
+        sequence += 64
+        sent += device.write(endpoint_out, chunk, timeout=1000)
+    report("Sink (host to badge)", sent, time.monotonic() - start)
+
+
+def run_loopback(device, endpoint_out, endpoint_in, duration, window):
+    latencies = []
+    sent = 0
+    received = 0
+    sequence = 0
+    expected = 0
+    dropped = 0
+    reordered = 0
+    pending = b""
+    start = time.monotonic()
+    while time.monotonic() - start < duration:
+        chunk = b"".join(record(sequence + index) for index in range(window))
+        sequence += window
+        sent += device.write(endpoint_out, chunk, timeout=1000)
+
+        # Read back the whole window before sending the next one
+        while received < sent:
+            pending += bytes(device.read(endpoint_in, 4096, timeout=1000))
+            while len(pending) >= RECORD_SIZE:
+                number, timestamp = struct.unpack_from("<IQ", pending, 0)
+                latencies.append((time.perf_counter_ns() - timestamp) / 1e3)
+                if gap(number, expected) < 0:
+                    reordered += 1
+                else:
+                    dropped += gap(number, expected)
+                    expected = (number + 1) & 0xFFFFFFFF
+                pending = pending[RECORD_SIZE:]
+                received += RECORD_SIZE
+    report("Loopback (both directions)", sent + received, time.monotonic() - start)
+    print(f"Round trip latency: p50 {percentile(latencies, 0.5):.0f} us, p90 {percentile(latencies, 0.9):.0f} us, "
+          f"p99 {percentile(latencies, 0.99):.0f} us, max {max(latencies, default=0):.0f} us")
+    print(f"Dropped sequence numbers: {dropped}, reordered records: {reordered}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure WebUSB throughput of the MCH2022 badge RP2040")
+    parser.add_argument("mode", choices=["source", "sink", "loopback"])
+    parser.add_argument("--interface", choices=INTERFACES.keys(), default="esp32")
+    parser.add_argument("--duration", type=float, default=5.0, help="seconds")
+    parser.add_argument("--window", type=int, default=16, help="records in flight in loopback mode")
+    args = parser.parse_args()
+
+    device = usb.core.find(idVendor=USB_VID, idProduct=USB_PID)
+    if device is None:
+        sys.exit("Badge not found")
+
+    interface, endpoint_out, endpoint_in = INTERFACES[args.interface]
+    if device.is_kernel_driver_active(interface):
+        device.detach_kernel_driver(interface)
+    usb.util.claim_interface(device, interface)
+
+    set_mode(device, interface, args.mode)
+    try:
+        if args.mode == "source":
+            run_source(device, endpoint_in, args.duration)
+        elif args.mode == "sink":
+            run_sink(device, endpoint_out, args.duration)
+        else:
+            run_loopback(device, endpoint_out, endpoint_in, args.duration, args.window)
+        results = get_results(device, interface)
+        print(f"Badge: {results['records']} records, {results['bytes']} bytes in {results['elapsed']:.2f} s, "
+              f"{results['dropped']} dropped sequence numbers, {results['reordered']} reordered records")
+    finally:
+        set_mode(device, interface, "off")
+        # Drain whatever the source mode still had queued
+        try:
+            while device.read(endpoint_in, 4096, timeout=100):
+                pass
+        except usb.core.USBError:
+            pass
+        usb.util.release_interface(device, interface)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware.h"
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "uart_dma.h"
+#include "uart_stats.h"
+
+#define TRACE_RING_SIZE 512  // Records, must be a power of two
+
+static trace_record_t    trace_ring[TRACE_RING_SIZE];
+static volatile uint32_t trace_head = 0;  // Records reserved, free running
+static uint32_t          trace_tail = 0;  // Records sent, only touched by trace_task()
+static volatile uint32_t trace_lost = 0;
+
+static bool    trace_sync_pending  = false;
+static uint8_t trace_stats_pending = 0;  // Ports of which the statistics still have to be sent
+static bool    trace_stats_reset   = false;
+
+static const uint8_t trace_padding[sizeof(trace_record_t)] = {0};
+
+void __not_in_flash_func(trace_event)(uint8_t event, uint8_t a, uint16_t b) {
+    // The Cortex-M0+ has no exclusive load and store, the slot is reserved and filled with interrupts disabled instead
+    uint32_t interrupts = save_and_disable_interrupts();
+    if ((trace_head - trace_tail) < TRACE_RING_SIZE) {
+        trace_record_t* record = &trace_ring[trace_head % TRACE_RING_SIZE];
+        record->time_us        = time_us_32();
+        record->event          = event;
+        record->a              = a;
+        record->b              = b;
+        trace_head++;
+    } else {
+        trace_lost++;
+    }
+    restore_interrupts(interrupts);
+}
+
+void trace_connected(bool connected) {
+    // Whatever was left in the FIFO from an earlier session would put the host out of step
+    if (connected) tud_cdc_n_write_clear(USB_CDC_TRACE);
+    trace_sync_pending = connected;
+}
+
+static bool trace_send(uint8_t event, uint8_t a, uint16_t b) {
+    trace_record_t record = {time_us_32(), event, a, b};
+    if (tud_cdc_n_write_available(USB_CDC_TRACE) < sizeof(record)) return false;
+    tud_cdc_n_write(USB_CDC_TRACE, &record, sizeof(record));
+    return true;
+}
+
+static void trace_commands() {
+    // Single character commands: s sends the port statistics, S sends and resets them
+    uint8_t command;
+    while (tud_cdc_n_read(USB_CDC_TRACE, &command, 1) == 1) {
+        if ((command == 's') || (command == 'S')) {
+            trace_stats_pending = UART_DMA_PORTS;
+            trace_stats_reset   = (command == 'S');
+        }
+    }
+}
+
+static void trace_send_stats() {
+    uint32_t length = (sizeof(uart_stats_t) + sizeof(trace_record_t) - 1) / sizeof(trace_record_t) * sizeof(trace_record_t);
+    while ((trace_stats_pending > 0) && (tud_cdc_n_write_available(USB_CDC_TRACE) >= sizeof(trace_record_t) + length)) {
+        uint8_t             port  = UART_DMA_PORTS - trace_stats_pending;
+        const uart_stats_t* stats = uart_stats_snapshot(port, trace_stats_reset);
+        trace_send(TRACE_EVENT_STATS, port, length);
+        tud_cdc_n_write(USB_CDC_TRACE, stats, sizeof(uart_stats_t));
+        tud_cdc_n_write(USB_CDC_TRACE, trace_padding, length - sizeof(uart_stats_t));
+        trace_stats_pending--;
+    }
+}
+
+void trace_task() {
+    if (!tud_cdc_n_connected(USB_CDC_TRACE)) return;  // Keep the oldest events until someone listens
+
+    trace_commands();
+    if (trace_sync_pending) {
+        if (!trace_send(TRACE_EVENT_SYNC, 0, TRACE_SYNC_MAGIC)) return;
+        trace_sync_pending = false;
+    }
+    trace_send_stats();
+
+    // Whole records only, straight from the ring
+    while (trace_tail != trace_head) {
+        uint32_t offset = trace_tail % TRACE_RING_SIZE;
+        uint32_t count  = trace_head - trace_tail;
+        if (count > TRACE_RING_SIZE - offset) count = TRACE_RING_SIZE - offset;
+        uint32_t room = tud_cdc_n_write_available(USB_CDC_TRACE) / sizeof(trace_record_t);
+        if (count > room) count = room;
+        if (count == 0) break;
+        tud_cdc_n_write(USB_CDC_TRACE, &trace_ring[offset], count * sizeof(trace_record_t));
+        trace_tail += count;
+    }
+
+    if ((trace_lost > 0) && (tud_cdc_n_write_available(USB_CDC_TRACE) >= sizeof(trace_record_t))) {
+        uint32_t interrupts = save_and_disable_interrupts();
+        uint32_t lost       = trace_lost;
+        trace_lost          = 0;
+        restore_interrupts(interrupts);
+        trace_send(TRACE_EVENT_LOST, 0, (lost > UINT16_MAX) ? UINT16_MAX : lost);
+    }
+
+    tud_cdc_n_write_flush(USB_CDC_TRACE);
+}
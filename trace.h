@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_SYNC_MAGIC 0x5AA5
+
+// Events of the binary trace stream on the trace CDC interface
+enum {
+    TRACE_EVENT_SYNC,            // Start of the stream after the host connected, b: TRACE_SYNC_MAGIC
+    TRACE_EVENT_LOST,            // b: events dropped while the ring was full
+    TRACE_EVENT_STATS,           // a: port, b: length of the uart_stats_t that follows, padded to whole records
+    TRACE_EVENT_I2C_ADDRESS,     // a: register
+    TRACE_EVENT_I2C_WRITE,       // a: register, b: value
+    TRACE_EVENT_I2C_READ,        // a: register, b: value
+    TRACE_EVENT_UART_RX,         // a: port, b: bytes handed to USB
+    TRACE_EVENT_UART_TX,         // a: port, b: bytes committed to the DMA channel
+    TRACE_EVENT_UART_DROPPED,    // a: port, b: bytes overwritten in the receive ring
+    TRACE_EVENT_USB_MOUNT,       // a: mounted
+    TRACE_EVENT_USB_SUSPEND,     // a: suspended, b: remote wakeup enabled
+    TRACE_EVENT_LINE_CODING,     // a: CDC interface, b: bit rate / 100
+    TRACE_EVENT_LINE_STATE,      // a: CDC interface, b: bit 0 DTR, bit 1 RTS
+    TRACE_EVENT_VENDOR_REQUEST,  // Vendor and class requests to the WebUSB interfaces, a: bRequest, b: wValue
+    TRACE_EVENT_ESP32_RESET,     // a: download mode
+    TRACE_EVENT_CLOCK,           // Clock governor level change, a: level, b: clk_sys in MHz
+};
+
+typedef struct __attribute__((packed)) {
+    uint32_t time_us;
+    uint8_t  event;
+    uint8_t  a;
+    uint16_t b;
+} trace_record_t;
+
+void trace_event(uint8_t event, uint8_t a, uint16_t b);  // Safe from any context, including interrupt handlers
+void trace_connected(bool connected);                    // The host opened or closed the trace CDC interface
+void trace_task();                                       // Drains the ring into the trace CDC interface and handles its commands
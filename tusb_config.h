@@ -96,11 +96,34 @@ extern "C" {
 
 //------------- CLASS -------------//
 #define CFG_TUD_HID    0
-#define CFG_TUD_CDC    2
+#define CFG_TUD_CDC    3
 #define CFG_TUD_MSC    0
 #define CFG_TUD_MIDI   0
 #define CFG_TUD_VENDOR 2
 
+// Buffer profile, selected with the USB_THROUGHPUT_PROFILE CMake option
+#ifndef USB_PROFILE_THROUGHPUT
+#define USB_PROFILE_THROUGHPUT 0
+#endif
+
+#if USB_PROFILE_THROUGHPUT
+// Full-speed bulk maximum packet size and FIFOs sized from a RAM budget shared by all CDC and vendor FIFOs (RX and TX each)
+#define USB_FIFO_RAM_BUDGET 16384
+#define USB_FIFO_SIZE       (USB_FIFO_RAM_BUDGET / ((CFG_TUD_CDC + CFG_TUD_VENDOR) * 2))
+
+// Every interface added shrinks the FIFOs, below two vendor endpoint buffers the profile no longer pays off
+#if USB_FIFO_SIZE < 1024
+#error "USB_FIFO_RAM_BUDGET is too small for the number of CDC and vendor interfaces"
+#endif
+
+#define CFG_TUD_CDC_RX_BUFSIZE USB_FIFO_SIZE
+#define CFG_TUD_CDC_TX_BUFSIZE USB_FIFO_SIZE
+
+#define CFG_TUD_VENDOR_EPSIZE     64
+#define CFG_TUD_VENDOR_EP_BUFSIZE 512
+#define CFG_TUD_VENDOR_RX_BUFSIZE USB_FIFO_SIZE
+#define CFG_TUD_VENDOR_TX_BUFSIZE USB_FIFO_SIZE
+#else
 #define CFG_TUD_CDC_RX_BUFSIZE 256
 #define CFG_TUD_CDC_TX_BUFSIZE 256
 
@@ -108,6 +131,7 @@ extern "C" {
 #define CFG_TUD_VENDOR_EP_BUFSIZE 512
 #define CFG_TUD_VENDOR_RX_BUFSIZE 512
 #define CFG_TUD_VENDOR_TX_BUFSIZE 512
+#endif
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_EP_BUFSIZE 16
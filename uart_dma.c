@@ -0,0 +1,258 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "uart_dma.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+#include "pico/stdlib.h"
+#include "trace.h"
+#include "uart_stats.h"
+
+#define UART_DMA_TX_SIZE  512         // Per staging buffer, two per port
+#define UART_DMA_RX_REARM 0x40000000  // Restart the receive channel before its transfer count runs out
+#define UART_DMA_XON      0x11
+#define UART_DMA_XOFF     0x13
+
+typedef struct {
+    uart_inst_t* uart;
+    uint8_t      index;
+
+    int      tx_channel;
+    uint8_t  tx_buffers[2][UART_DMA_TX_SIZE];
+    uint32_t tx_lengths[2];    // Committed length, 0 when the buffer is free
+    uint32_t tx_committed[2];  // Commit timestamp in us, for the latency statistics
+    int8_t   tx_active;        // Buffer the DMA channel is sending, -1 when idle
+    uint8_t  tx_next;          // Buffer handed out next
+    uint32_t tx_offset;        // Bytes of the active buffer sent before the channel was paused
+    bool     tx_paused;
+
+    int      rx_channel;
+    uint8_t* rx_ring;
+    uint32_t rx_base;   // Bytes received before the channel was last armed
+    uint32_t rx_armed;  // Transfer count the channel was armed with
+    uint32_t rx_read;   // Bytes consumed, free running
+    uint32_t rx_dropped;
+    bool     rx_paused;
+    bool     rx_xon_xoff;  // Strip flow control characters from received data and act on them
+} uart_dma_port_t;
+
+static uint8_t uart_dma_rx_rings[UART_DMA_PORTS][UART_DMA_RX_RING_SIZE] __attribute__((aligned(UART_DMA_RX_RING_SIZE)));
+
+static uart_dma_port_t uart_dma_ports[UART_DMA_PORTS];
+
+static uint32_t uart_dma_rx_written(uart_dma_port_t* port) { return port->rx_base + (port->rx_armed - dma_hw->ch[port->rx_channel].transfer_count); }
+
+static void uart_dma_rx_arm(uart_dma_port_t* port) {
+    // Continue at the current ring position, bytes arriving meanwhile wait in the UART FIFO
+    dma_channel_abort(port->rx_channel);
+    port->rx_base  = uart_dma_rx_written(port);
+    port->rx_armed = 0xFFFFFFFF;
+    dma_channel_set_write_addr(port->rx_channel, &port->rx_ring[port->rx_base % UART_DMA_RX_RING_SIZE], false);
+    dma_channel_set_trans_count(port->rx_channel, port->rx_armed, true);
+}
+
+static void uart_dma_setup_port(uart_dma_port_t* port, uint8_t index, uart_inst_t* uart, uint8_t* ring) {
+    port->uart      = uart;
+    port->index     = index;
+    port->rx_ring   = ring;
+    port->tx_active = -1;
+
+    port->tx_channel          = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(port->tx_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, uart_get_dreq(uart, true));
+    dma_channel_configure(port->tx_channel, &config, &uart_get_hw(uart)->dr, NULL, 0, false);
+
+    port->rx_channel = dma_claim_unused_channel(true);
+    config           = dma_channel_get_default_config(port->rx_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, __builtin_ctz(UART_DMA_RX_RING_SIZE));
+    channel_config_set_dreq(&config, uart_get_dreq(uart, false));
+    port->rx_armed = 0xFFFFFFFF;
+    dma_channel_configure(port->rx_channel, &config, ring, &uart_get_hw(uart)->dr, port->rx_armed, true);
+}
+
+void uart_dma_init() {
+    uart_dma_setup_port(&uart_dma_ports[UART_DMA_ESP32], UART_DMA_ESP32, UART_ESP32, uart_dma_rx_rings[UART_DMA_ESP32]);
+    uart_dma_setup_port(&uart_dma_ports[UART_DMA_FPGA], UART_DMA_FPGA, UART_FPGA, uart_dma_rx_rings[UART_DMA_FPGA]);
+    uart_stats_init();
+}
+
+static void uart_dma_tx_retire(uart_dma_port_t* port) {
+    // Release the buffer once the channel has handed its last byte to the UART
+    if ((port->tx_active < 0) || port->tx_paused || dma_channel_is_busy(port->tx_channel)) return;
+    uart_stats_latency(port->index, time_us_32() - port->tx_committed[port->tx_active]);
+    port->tx_lengths[port->tx_active] = 0;
+    port->tx_active                   = -1;
+    port->tx_offset                   = 0;
+}
+
+static void uart_dma_tx_start(uart_dma_port_t* port) {
+    if (port->tx_paused) return;
+    if (port->tx_active >= 0) {
+        // Resume a buffer that was paused halfway
+        uint32_t length = port->tx_lengths[port->tx_active];
+        dma_channel_transfer_from_buffer_now(port->tx_channel, &port->tx_buffers[port->tx_active][port->tx_offset], length - port->tx_offset);
+        return;
+    }
+    // Send the oldest committed buffer, the buffers are used in turns
+    for (int8_t index = 0; index < 2; index++) {
+        int8_t buffer = (port->tx_next + index) % 2;
+        if (port->tx_lengths[buffer] > 0) {
+            port->tx_active = buffer;
+            dma_channel_transfer_from_buffer_now(port->tx_channel, port->tx_buffers[buffer], port->tx_lengths[buffer]);
+            return;
+        }
+    }
+}
+
+static void uart_dma_tx_update(uart_dma_port_t* port) {
+    // Flow control can pause transmission from an interrupt
+    uint32_t interrupts = save_and_disable_interrupts();
+    uart_dma_tx_retire(port);
+    if (port->tx_active < 0) uart_dma_tx_start(port);
+    restore_interrupts(interrupts);
+}
+
+void uart_dma_task() {
+    for (uint8_t index = 0; index < UART_DMA_PORTS; index++) {
+        uart_dma_port_t* port = &uart_dma_ports[index];
+
+        uart_dma_tx_update(port);
+
+        if (!port->rx_paused && (dma_hw->ch[port->rx_channel].transfer_count < UART_DMA_RX_REARM)) uart_dma_rx_arm(port);
+    }
+}
+
+void uart_dma_tx_pause(uint8_t port_index, bool paused) {
+    uart_dma_port_t* port       = &uart_dma_ports[port_index];
+    uint32_t         interrupts = save_and_disable_interrupts();
+    if (paused != port->tx_paused) {
+        if (paused && (port->tx_active >= 0)) {
+            // Whatever the UART FIFO already holds still goes out
+            dma_channel_abort(port->tx_channel);
+            port->tx_offset = port->tx_lengths[port->tx_active] - dma_hw->ch[port->tx_channel].transfer_count;
+        }
+        port->tx_paused = paused;
+        if (!paused && (port->tx_active >= 0) && (port->tx_offset >= port->tx_lengths[port->tx_active])) {
+            uart_dma_tx_retire(port);  // The buffer completed right before the pause
+        }
+        if (!paused) uart_dma_tx_start(port);
+    }
+    restore_interrupts(interrupts);
+}
+
+void uart_dma_rx_pause(uint8_t port_index, bool paused) {
+    uart_dma_port_t* port = &uart_dma_ports[port_index];
+    if (paused == port->rx_paused) return;
+    if (paused) {
+        dma_channel_abort(port->rx_channel);
+    } else {
+        uart_dma_rx_arm(port);
+    }
+    port->rx_paused = paused;
+}
+
+void uart_dma_set_xon_xoff(uint8_t port_index, bool enable) {
+    uart_dma_ports[port_index].rx_xon_xoff = enable;
+    if (!enable) uart_dma_tx_pause(port_index, false);
+}
+
+uint8_t* uart_dma_write_buffer(uint8_t port_index, uint32_t* capacity) {
+    uart_dma_port_t* port = &uart_dma_ports[port_index];
+    if (port->tx_lengths[port->tx_next] > 0) {
+        *capacity = 0;
+        return NULL;
+    }
+    *capacity = UART_DMA_TX_SIZE;
+    return port->tx_buffers[port->tx_next];
+}
+
+void uart_dma_write_commit(uint8_t port_index, uint32_t length) {
+    uart_dma_port_t* port = &uart_dma_ports[port_index];
+    if (length == 0) return;
+    port->tx_lengths[port->tx_next]   = length;
+    port->tx_committed[port->tx_next] = time_us_32();
+    port->tx_next                     = (port->tx_next + 1) % 2;
+    uart_stats_tx(port_index, length);
+    trace_event(TRACE_EVENT_UART_TX, port_index, length);
+    uart_dma_tx_update(port);
+}
+
+bool uart_dma_write_idle(uint8_t port_index) {
+    uart_dma_port_t* port = &uart_dma_ports[port_index];
+    if (dma_channel_is_busy(port->tx_channel)) return false;
+    if (port->tx_paused && (port->tx_active >= 0)) return false;
+    for (int8_t buffer = 0; buffer < 2; buffer++) {
+        if ((port->tx_lengths[buffer] > 0) && (buffer != port->tx_active)) return false;
+    }
+    return true;
+}
+
+uint32_t uart_dma_read_available(uint8_t port_index) {
+    uart_dma_port_t* port      = &uart_dma_ports[port_index];
+    uint32_t         available = uart_dma_rx_written(port) - port->rx_read;
+    if (available > UART_DMA_RX_RING_SIZE) {
+        // The ring wrapped over unread data, skip to the oldest byte that is still intact
+        uint32_t lost     = available - UART_DMA_RX_RING_SIZE;
+        port->rx_dropped += lost;
+        port->rx_read    += lost;
+        available         = UART_DMA_RX_RING_SIZE;
+        uart_stats_dropped(port_index, lost);
+        trace_event(TRACE_EVENT_UART_DROPPED, port_index, (lost > UINT16_MAX) ? UINT16_MAX : lost);
+    }
+    uart_stats_rx_level(port_index, available);
+    return available;
+}
+
+uint32_t uart_dma_read_peek(uint8_t port_index, const uint8_t** data) {
+    uart_dma_port_t* port      = &uart_dma_ports[port_index];
+    uint32_t         available = uart_dma_read_available(port_index);
+    uint32_t         offset    = port->rx_read % UART_DMA_RX_RING_SIZE;
+    uint32_t         linear    = UART_DMA_RX_RING_SIZE - offset;
+    uint32_t         length    = (available < linear) ? available : linear;
+    if (port->rx_xon_xoff) {
+        // Consume flow control characters at the front and stop the region at the next one
+        while ((length > 0) && ((port->rx_ring[offset] == UART_DMA_XON) || (port->rx_ring[offset] == UART_DMA_XOFF))) {
+            uart_dma_tx_pause(port_index, port->rx_ring[offset] == UART_DMA_XOFF);
+            port->rx_read++;
+            offset++;
+            length--;
+        }
+        for (uint32_t position = 0; position < length; position++) {
+            if ((port->rx_ring[offset + position] == UART_DMA_XON) || (port->rx_ring[offset + position] == UART_DMA_XOFF)) {
+                length = position;
+                break;
+            }
+        }
+    }
+    *data = &port->rx_ring[offset % UART_DMA_RX_RING_SIZE];
+    return length;
+}
+
+void uart_dma_read_advance(uint8_t port_index, uint32_t length) {
+    uart_dma_ports[port_index].rx_read += length;
+    uart_stats_rx(port_index, length);
+    if (length > 0) trace_event(TRACE_EVENT_UART_RX, port_index, length);
+}
+
+uint32_t uart_dma_read_dropped(uint8_t port_index) {
+    uart_dma_port_t* port    = &uart_dma_ports[port_index];
+    uint32_t         dropped = port->rx_dropped;
+    port->rx_dropped         = 0;
+    return dropped;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Ports, in the same order as the USB CDC interfaces
+#define UART_DMA_ESP32 0
+#define UART_DMA_FPGA  1
+#define UART_DMA_PORTS 2
+
+#define UART_DMA_RX_RING_SIZE 2048  // Must be a power of two, the DMA wraps the write address
+
+void uart_dma_init();
+void uart_dma_task();  // Starts queued transmit buffers and keeps the receive ring armed
+
+// Transmit: fill a free staging buffer (for example straight from tud_cdc_n_read()) and commit it to the DMA channel
+uint8_t* uart_dma_write_buffer(uint8_t port, uint32_t* capacity);  // Returns NULL while both staging buffers are in use
+void     uart_dma_write_commit(uint8_t port, uint32_t length);
+bool     uart_dma_write_idle(uint8_t port);
+void     uart_dma_tx_pause(uint8_t port, bool paused);  // Holds transmission mid-buffer, safe to call from interrupts
+
+// Receive: the DMA channel writes into a ring, readers get linear regions of it without copying
+uint32_t uart_dma_read_peek(uint8_t port, const uint8_t** data);  // Returns the number of contiguous bytes at data
+void     uart_dma_read_advance(uint8_t port, uint32_t length);
+uint32_t uart_dma_read_available(uint8_t port);
+uint32_t uart_dma_read_dropped(uint8_t port);               // Bytes overwritten before they were read, cleared on read
+void     uart_dma_rx_pause(uint8_t port, bool paused);      // Stops draining the UART FIFO, hardware RTS deasserts once it fills up
+void     uart_dma_set_xon_xoff(uint8_t port, bool enable);  // Strip XON and XOFF from received data and pause transmission on XOFF
@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "uart_flow.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/uart.h"
+#include "ir.h"
+#include "pico/stdlib.h"
+#include "uart_dma.h"
+
+// Receive ring fill levels at which the sender is stopped and started again
+#define UART_FLOW_HIGH_WATER ((UART_DMA_RX_RING_SIZE * 3) / 4)
+#define UART_FLOW_LOW_WATER  (UART_DMA_RX_RING_SIZE / 4)
+
+#define UART_FLOW_XON  0x11
+#define UART_FLOW_XOFF 0x13
+
+static uint8_t uart_flow_modes[UART_DMA_PORTS] = {UART_FLOW_NONE, UART_FLOW_NONE};
+static bool    uart_flow_stopped[UART_DMA_PORTS];  // The sender has been asked to stop
+static bool    uart_flow_cts_handler = false;
+
+static void uart_flow_fpga_cts() {
+    uint32_t events = gpio_get_irq_event_mask(UART_FPGA_CTS_PIN) & (GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE);
+    gpio_acknowledge_irq(UART_FPGA_CTS_PIN, events);
+    uart_dma_tx_pause(UART_DMA_FPGA, gpio_get(UART_FPGA_CTS_PIN));
+}
+
+static void uart_flow_stop(uint8_t port, bool stop) {
+    if (stop == uart_flow_stopped[port]) return;
+    uart_flow_stopped[port] = stop;
+    switch (uart_flow_modes[port]) {
+        case UART_FLOW_RTS_CTS:
+            if (port == UART_DMA_ESP32) {
+                uart_dma_rx_pause(port, stop);  // The UART deasserts RTS by itself once its FIFO fills up
+            } else {
+                gpio_put(UART_FPGA_RTS_PIN, stop);
+            }
+            break;
+        case UART_FLOW_XON_XOFF:
+            uart_putc_raw((port == UART_DMA_ESP32) ? UART_ESP32 : UART_FPGA, stop ? UART_FLOW_XOFF : UART_FLOW_XON);
+            break;
+        default:
+            break;
+    }
+}
+
+static void uart_flow_disable(uint8_t port) {
+    uart_flow_stop(port, false);
+    switch (uart_flow_modes[port]) {
+        case UART_FLOW_RTS_CTS:
+            if (port == UART_DMA_ESP32) {
+                uart_set_hw_flow(UART_ESP32, false, false);
+                gpio_set_function(UART_ESP32_CTS_PIN, GPIO_FUNC_SIO);
+                gpio_set_function(UART_ESP32_RTS_PIN, GPIO_FUNC_SIO);
+            } else {
+                gpio_set_irq_enabled(UART_FPGA_CTS_PIN, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, false);
+                gpio_set_dir(UART_FPGA_RTS_PIN, false);
+                uart_dma_tx_pause(port, false);
+            }
+            break;
+        case UART_FLOW_XON_XOFF:
+            uart_dma_set_xon_xoff(port, false);
+            break;
+        default:
+            break;
+    }
+    uart_flow_modes[port] = UART_FLOW_NONE;
+}
+
+static bool uart_flow_pins_free(uint8_t port) {
+    if (port == UART_DMA_ESP32) return !ir_rx_owns_pin(UART_ESP32_CTS_PIN) && !ir_rx_owns_pin(UART_ESP32_RTS_PIN);
+    return !ir_rx_owns_pin(UART_FPGA_CTS_PIN) && !ir_rx_owns_pin(UART_FPGA_RTS_PIN);
+}
+
+void uart_flow_set(uint8_t port, uint8_t mode) {
+    if ((port >= UART_DMA_PORTS) || (mode >= UART_FLOW_MODES) || (mode == uart_flow_modes[port])) return;
+    if ((mode == UART_FLOW_RTS_CTS) && !uart_flow_pins_free(port)) return;  // The IR receiver listens on CTS or RTS, keep the current mode
+    uart_flow_disable(port);
+    switch (mode) {
+        case UART_FLOW_RTS_CTS:
+            if (port == UART_DMA_ESP32) {
+                gpio_set_function(UART_ESP32_CTS_PIN, GPIO_FUNC_UART);
+                gpio_set_function(UART_ESP32_RTS_PIN, GPIO_FUNC_UART);
+                uart_set_hw_flow(UART_ESP32, true, true);
+            } else {
+                gpio_set_function(UART_FPGA_CTS_PIN, GPIO_FUNC_SIO);
+                gpio_set_dir(UART_FPGA_CTS_PIN, false);
+                gpio_set_function(UART_FPGA_RTS_PIN, GPIO_FUNC_SIO);
+                gpio_put(UART_FPGA_RTS_PIN, false);
+                gpio_set_dir(UART_FPGA_RTS_PIN, true);
+                if (!uart_flow_cts_handler) {
+                    gpio_add_raw_irq_handler(UART_FPGA_CTS_PIN, uart_flow_fpga_cts);
+                    uart_flow_cts_handler = true;
+                }
+                gpio_set_irq_enabled(UART_FPGA_CTS_PIN, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+                irq_set_enabled(IO_IRQ_BANK0, true);
+                uart_dma_tx_pause(port, gpio_get(UART_FPGA_CTS_PIN));
+            }
+            break;
+        case UART_FLOW_XON_XOFF:
+            uart_dma_set_xon_xoff(port, true);
+            break;
+        default:
+            break;
+    }
+    uart_flow_modes[port] = mode;
+}
+
+uint8_t uart_flow_get(uint8_t port) { return (port < UART_DMA_PORTS) ? uart_flow_modes[port] : UART_FLOW_NONE; }
+
+bool uart_flow_owns_pin(uint8_t gpio) {
+    if ((uart_flow_modes[UART_DMA_ESP32] == UART_FLOW_RTS_CTS) && ((gpio == UART_ESP32_CTS_PIN) || (gpio == UART_ESP32_RTS_PIN))) return true;
+    if ((uart_flow_modes[UART_DMA_FPGA] == UART_FLOW_RTS_CTS) && ((gpio == UART_FPGA_CTS_PIN) || (gpio == UART_FPGA_RTS_PIN))) return true;
+    return false;
+}
+
+void uart_flow_task() {
+    for (uint8_t port = 0; port < UART_DMA_PORTS; port++) {
+        if (uart_flow_modes[port] == UART_FLOW_NONE) continue;
+        uint32_t level = uart_dma_read_available(port);
+        if (level >= UART_FLOW_HIGH_WATER) uart_flow_stop(port, true);
+        if (level <= UART_FLOW_LOW_WATER) uart_flow_stop(port, false);
+    }
+}
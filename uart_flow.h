@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+    UART_FLOW_NONE,
+    UART_FLOW_RTS_CTS,   // Hardware on the ESP32 UART, GPIO driven on the FPGA UART
+    UART_FLOW_XON_XOFF,  // Only for text, XON and XOFF bytes are removed from the received data
+    UART_FLOW_MODES,
+};
+
+void    uart_flow_set(uint8_t port, uint8_t mode);  // Port as in uart_dma.h
+uint8_t uart_flow_get(uint8_t port);
+bool    uart_flow_owns_pin(uint8_t gpio);  // The pin is a CTS or RTS line of an enabled RTS/CTS mode
+void    uart_flow_task();
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "uart_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+#include "pico/stdlib.h"
+#include "uart_dma.h"
+
+static uart_stats_t uart_stats[UART_DMA_PORTS];
+static uart_stats_t uart_stats_copy;
+
+static void uart_stats_errors(uart_inst_t* uart, uart_stats_t* stats) {
+    uart_hw_t* hw     = uart_get_hw(uart);
+    uint32_t   status = hw->mis;
+    if (status & UART_UARTMIS_OEMIS_BITS) stats->overrun_errors++;
+    if (status & UART_UARTMIS_FEMIS_BITS) stats->framing_errors++;
+    if (status & UART_UARTMIS_PEMIS_BITS) stats->parity_errors++;
+    if (status & UART_UARTMIS_BEMIS_BITS) stats->break_errors++;
+    hw->icr = status;
+}
+
+static void uart_stats_esp32_irq() { uart_stats_errors(UART_ESP32, &uart_stats[UART_DMA_ESP32]); }
+
+static void uart_stats_fpga_irq() { uart_stats_errors(UART_FPGA, &uart_stats[UART_DMA_FPGA]); }
+
+static void uart_stats_enable(uart_inst_t* uart, uint irq, irq_handler_t handler) {
+    // Only the error interrupts, received data is moved by DMA
+    uart_hw_t* hw = uart_get_hw(uart);
+    hw->icr       = UART_UARTICR_OEIC_BITS | UART_UARTICR_BEIC_BITS | UART_UARTICR_PEIC_BITS | UART_UARTICR_FEIC_BITS;
+    hw->imsc      = UART_UARTIMSC_OEIM_BITS | UART_UARTIMSC_BEIM_BITS | UART_UARTIMSC_PEIM_BITS | UART_UARTIMSC_FEIM_BITS;
+    irq_set_exclusive_handler(irq, handler);
+    irq_set_enabled(irq, true);
+}
+
+void uart_stats_init() {
+    memset(uart_stats, 0, sizeof(uart_stats));
+    uart_stats_enable(UART_ESP32, UART0_IRQ, uart_stats_esp32_irq);
+    uart_stats_enable(UART_FPGA, UART1_IRQ, uart_stats_fpga_irq);
+}
+
+void uart_stats_rx(uint8_t port, uint32_t length) { uart_stats[port].rx_bytes += length; }
+
+void uart_stats_tx(uint8_t port, uint32_t length) { uart_stats[port].tx_bytes += length; }
+
+void uart_stats_dropped(uint8_t port, uint32_t length) { uart_stats[port].rx_dropped += length; }
+
+void uart_stats_latency(uint8_t port, uint32_t latency_us) {
+    uint8_t bucket = (latency_us > 1) ? (31 - __builtin_clz(latency_us)) : 0;
+    if (bucket >= UART_STATS_LATENCY_BUCKETS) bucket = UART_STATS_LATENCY_BUCKETS - 1;
+    uart_stats[port].latency[bucket]++;
+}
+
+void uart_stats_rx_level(uint8_t port, uint32_t level) {
+    if (level > uart_stats[port].rx_ring_high) uart_stats[port].rx_ring_high = level;
+}
+
+void uart_stats_usb_level(uint8_t port, uint32_t level) {
+    if (level > uart_stats[port].usb_fifo_high) uart_stats[port].usb_fifo_high = level;
+}
+
+const uart_stats_t* uart_stats_snapshot(uint8_t port, bool reset) {
+    // The error counters are updated from the UART interrupt
+    uint32_t interrupts = save_and_disable_interrupts();
+    memcpy(&uart_stats_copy, &uart_stats[port], sizeof(uart_stats_t));
+    if (reset) memset(&uart_stats[port], 0, sizeof(uart_stats_t));
+    restore_interrupts(interrupts);
+    return &uart_stats_copy;
+}
+
+uint32_t uart_stats_bytes(uint8_t port) { return (port < UART_DMA_PORTS) ? uart_stats[port].rx_bytes + uart_stats[port].tx_bytes : 0; }
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define UART_STATS_LATENCY_BUCKETS 16
+
+// Per port counters, as returned by the get port statistics vendor request
+typedef struct __attribute__((packed)) {
+    uint32_t rx_bytes;        // UART to USB, handed to the USB FIFO
+    uint32_t tx_bytes;        // USB to UART, committed to the DMA channel
+    uint32_t rx_dropped;      // Overwritten in the receive ring before USB took them
+    uint32_t overrun_errors;  // From the UART receive status, counted in the UART interrupt
+    uint32_t framing_errors;
+    uint32_t parity_errors;
+    uint32_t break_errors;
+    uint16_t rx_ring_high;   // High-water mark of the DMA receive ring in bytes
+    uint16_t usb_fifo_high;  // High-water mark of the USB IN FIFO in bytes
+    // USB to UART latency, from the USB read until the DMA channel handed the last byte to the UART, bucket n counts [2^n, 2^(n+1)) us
+    uint32_t latency[UART_STATS_LATENCY_BUCKETS];
+} uart_stats_t;
+
+void uart_stats_init();
+
+void uart_stats_rx(uint8_t port, uint32_t length);
+void uart_stats_tx(uint8_t port, uint32_t length);
+void uart_stats_dropped(uint8_t port, uint32_t length);
+void uart_stats_latency(uint8_t port, uint32_t latency_us);
+void uart_stats_rx_level(uint8_t port, uint32_t level);
+void uart_stats_usb_level(uint8_t port, uint32_t level);
+
+const uart_stats_t* uart_stats_snapshot(uint8_t port, bool reset);  // Consistent copy that stays valid until the next call
+uint32_t            uart_stats_bytes(uint8_t port);                 // Received plus transmitted bytes, leaves the snapshot alone
@@ -11,7 +11,11 @@
 #include <string.h>
 
 #include "bsp/board.h"
+#include "console_history.h"
+#include "esp32_loader.h"
+#include "esptool_sniffer.h"
 #include "hardware.h"
+#include "hardware/clocks.h"
 #include "hardware/uart.h"
 #include "i2c_peripheral.h"
 #include "pico/binary_info.h"
@@ -19,8 +23,14 @@
 #include "pico/stdlib.h"
 #include "pico/time.h"
 #include "pico/types.h"
+#include "trace.h"
 #include "tusb.h"
+#include "uart_dma.h"
+#include "uart_flow.h"
+#include "uart_stats.h"
+#include "usb_benchmark.h"
 #include "usb_descriptors.h"
+#include "usb_stats.h"
 #include "webusb_task.h"
 
 bool    esp32_reset_active    = false;
@@ -37,6 +47,14 @@ cdc_line_coding_t current_line_coding[2];
 cdc_line_coding_t cdc_requested_line_coding[2];
 cdc_line_coding_t webusb_requested_line_coding[2];
 cdc_line_coding_t fpga_loopback_requested_line_coding;
+uint32_t          actual_baudrate[2];
+uint32_t          esptool_restore_baudrate = 0;  // ESP32 rate before esptool switched it, restored when the ESP32 resets
+
+// UART to USB coalescing, indexed like the WebUSB interfaces
+#define USB_FLUSH_PACKET_SIZE 64
+uint16_t usb_flush_budget_us[2] = {1000, 1000};  // 0 flushes after every write
+uint32_t usb_flush_pending[2]   = {0, 0};
+uint32_t usb_flush_since[2]     = {0, 0};  // Time the oldest unflushed byte was written
 
 void setup_uart() {
     gpio_init(ESP32_BL_PIN);
@@ -47,7 +65,7 @@ void setup_uart() {
     gpio_set_dir(ESP32_EN_PIN, true);
     gpio_put(ESP32_EN_PIN, false);
 
-    uart_init(UART_ESP32, 115200);
+    actual_baudrate[0] = uart_init(UART_ESP32, 115200);
     gpio_set_function(UART_ESP32_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART_ESP32_RX_PIN, GPIO_FUNC_UART);
     uart_set_format(UART_ESP32, 8, 1, 0);
@@ -59,7 +77,7 @@ void setup_uart() {
     memcpy(&cdc_requested_line_coding[0], &current_line_coding[0], sizeof(cdc_line_coding_t));
     memcpy(&webusb_requested_line_coding[0], &current_line_coding[0], sizeof(cdc_line_coding_t));
 
-    uart_init(UART_FPGA, 115200);
+    actual_baudrate[1] = uart_init(UART_FPGA, 115200);
     gpio_set_function(UART_FPGA_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART_FPGA_RX_PIN, GPIO_FUNC_UART);
     uart_set_format(UART_FPGA, 8, 1, 0);
@@ -75,11 +93,16 @@ void setup_uart() {
     fpga_loopback_requested_line_coding.data_bits = 8;
     fpga_loopback_requested_line_coding.parity    = 0;
     fpga_loopback_requested_line_coding.stop_bits = 1;
+
+    uart_dma_init();
 }
 
-void cdc_send(uint8_t itf, uint8_t* buf, uint32_t count) {
-    tud_cdc_n_write(itf, buf, count);
-    tud_cdc_n_write_flush(itf);
+uint32_t cdc_send(uint8_t itf, const uint8_t* buf, uint32_t count) {
+    uint32_t written = tud_cdc_n_write(itf, buf, count);
+    uart_stats_usb_level((itf == USB_CDC_ESP32) ? UART_DMA_ESP32 : UART_DMA_FPGA, CFG_TUD_CDC_TX_BUFSIZE - tud_cdc_n_write_available(itf));
+    if (itf == USB_CDC_ESP32) usb_stats_in(USB_STATS_CDC_ESP32, written);
+    if (itf == USB_CDC_FPGA) usb_stats_in(USB_STATS_CDC_FPGA, written);
+    return written;
 }
 
 uint calc_data_bits(uint requested) {
@@ -146,12 +169,15 @@ uint calc_parity(uint requested) {
 void apply_line_coding(uint8_t itf) {
     uart_inst_t* uart;
     uint8_t      webusb_index;
+    uint8_t      dma_port;
     if (itf == USB_CDC_ESP32) {
         uart         = UART_ESP32;
         webusb_index = WEBUSB_IDX_ESP32;
+        dma_port     = UART_DMA_ESP32;
     } else if (itf == USB_CDC_FPGA) {
         uart         = UART_FPGA;
         webusb_index = WEBUSB_IDX_FPGA;
+        dma_port     = UART_DMA_FPGA;
     } else {
         return;
     }
@@ -166,10 +192,19 @@ void apply_line_coding(uint8_t itf) {
         target_line_coding = &cdc_requested_line_coding[itf];
     }
 
+    if (memcmp(&current_line_coding[itf], target_line_coding, sizeof(cdc_line_coding_t)) == 0) {
+        return;
+    }
+
+    if (!uart_dma_write_idle(dma_port)) {
+        return;  // Data queued before the change still goes out with the old settings, try again on the next pass
+    }
+    uart_tx_wait_blocking(uart);  // Drain the last few bytes from the hardware FIFO
+
     bool changed = false;
 
     if (current_line_coding[itf].bit_rate != target_line_coding->bit_rate) {
-        uart_set_baudrate(uart, target_line_coding->bit_rate);
+        actual_baudrate[itf] = uart_set_baudrate(uart, target_line_coding->bit_rate);
         changed = true;
     }
 
@@ -185,58 +220,149 @@ void apply_line_coding(uint8_t itf) {
     }
 }
 
-void uart_task(void) {
-    uint8_t  buffer[256];
-    uint32_t length = 0;
+static cdc_line_coding_t* esp32_requested_line_coding() {
+    return get_webusb_connected(WEBUSB_IDX_ESP32) ? &webusb_requested_line_coding[USB_CDC_ESP32] : &cdc_requested_line_coding[USB_CDC_ESP32];
+}
 
+static void esp32_follow_baudrate(uint32_t baudrate) {
+    // The loader already switched, nothing is sent to it until the host follows as well
+    cdc_line_coding_t* requested = esp32_requested_line_coding();
+    if (esptool_restore_baudrate == 0) esptool_restore_baudrate = requested->bit_rate;
+    requested->bit_rate = baudrate;
     apply_line_coding(USB_CDC_ESP32);
-    apply_line_coding(USB_CDC_FPGA);
+}
+
+static void usb_flush(uint8_t index) {
+    // Both interfaces, data written before WebUSB connected or disconnected still has to go out
+    uint8_t usb_cdcs[] = {USB_CDC_ESP32, USB_CDC_FPGA};
+    tud_cdc_n_write_flush(usb_cdcs[index]);
+    tud_vendor_n_flush(index);
+    usb_flush_pending[index] = 0;
+}
 
-    length = 0;
-    while (uart_is_readable(UART_ESP32) && (length < sizeof(buffer))) {
-        buffer[length] = uart_getc(UART_ESP32);
-        length++;
+static void usb_flush_written(uint8_t index, const uint8_t* data, uint32_t length) {
+    // Flush on a full packet, at the end of a line or once the latency budget is used up
+    if (length == 0) return;
+    if (usb_flush_pending[index] == 0) usb_flush_since[index] = time_us_32();
+    usb_flush_pending[index] += length;
+    if ((usb_flush_budget_us[index] == 0) || (usb_flush_pending[index] >= USB_FLUSH_PACKET_SIZE) || (memchr(data, '\n', length) != NULL)) {
+        usb_flush(index);
     }
+}
 
-    if (length > 0) {
+static void console_replay(uint8_t index) {
+    // Replayed history goes through the same FIFOs as live data, only what fits is taken from the history
+    uint8_t  usb_cdcs[] = {USB_CDC_ESP32, USB_CDC_FPGA};
+    uint8_t  buffer[256];
+    uint32_t capacity;
+    uint32_t length;
+    if (get_webusb_connected(index)) {
+        if (usb_benchmark_active(index)) return;
+        capacity = tud_vendor_n_write_available(index);
+        if (capacity > sizeof(buffer)) capacity = sizeof(buffer);
+        length = console_history_replay(index, buffer, capacity);
+        length = tud_vendor_n_write(index, buffer, length);
+        usb_stats_in((index == WEBUSB_IDX_ESP32) ? USB_STATS_WEBUSB_ESP32 : USB_STATS_WEBUSB_FPGA, length);
+    } else {
+        capacity = tud_cdc_n_write_available(usb_cdcs[index]);
+        if (capacity > sizeof(buffer)) capacity = sizeof(buffer);
+        length = console_history_replay(index, buffer, capacity);
+        length = cdc_send(usb_cdcs[index], buffer, length);
+    }
+    usb_flush_written(index, buffer, length);
+}
+
+static void usb_flush_expired() {
+    for (uint8_t index = 0; index < 2; index++) {
+        if ((usb_flush_pending[index] > 0) && ((time_us_32() - usb_flush_since[index]) >= usb_flush_budget_us[index])) usb_flush(index);
+    }
+}
+
+void uart_task(void) {
+    const uint8_t* data;
+    uint8_t*       buffer;
+    uint32_t       capacity;
+    uint32_t       length;
+
+    if (!esp32_loader_active()) apply_line_coding(USB_CDC_ESP32);
+    apply_line_coding(USB_CDC_FPGA);
+    uart_dma_task();
+    uart_flow_task();
+    esp32_loader_task();
+
+    // UART to USB, straight from the DMA receive ring into the USB FIFOs, whatever does not fit stays in the ring
+    length = esp32_loader_active() ? 0 : uart_dma_read_peek(UART_DMA_ESP32, &data);
+    if ((length > 0) && console_history_replaying(UART_DMA_ESP32)) {
+        // Live data queues up behind the history until the replay caught up
+        console_history_capture(UART_DMA_ESP32, data, length);
+        uart_dma_read_advance(UART_DMA_ESP32, length);
+    } else if (length > 0) {
         if (get_webusb_connected(WEBUSB_IDX_ESP32)) {
-            tud_vendor_n_write(WEBUSB_IDX_ESP32, buffer, length);
-            tud_vendor_n_flush(WEBUSB_IDX_ESP32);
+            if (!usb_benchmark_active(WEBUSB_IDX_ESP32)) {  // The benchmark owns the interface, drop console output meanwhile
+                length = tud_vendor_n_write(WEBUSB_IDX_ESP32, data, length);
+                usb_stats_in(USB_STATS_WEBUSB_ESP32, length);
+                uart_stats_usb_level(UART_DMA_ESP32, CFG_TUD_VENDOR_TX_BUFSIZE - tud_vendor_n_write_available(WEBUSB_IDX_ESP32));
+            }
         } else {
-            cdc_send(0, buffer, length);
+            length = cdc_send(0, data, length);
         }
+        usb_flush_written(WEBUSB_IDX_ESP32, data, length);
+        uint32_t baudrate = esptool_sniffer_device(data, length);
+        if (baudrate > 0) esp32_follow_baudrate(baudrate);
+        console_history_capture(UART_DMA_ESP32, data, length);
+        uart_dma_read_advance(UART_DMA_ESP32, length);
     }
+    if (console_history_replaying(UART_DMA_ESP32) && !esp32_loader_active()) console_replay(WEBUSB_IDX_ESP32);
 
-    length = 0;
-    while (uart_is_readable(UART_FPGA) && (length < sizeof(buffer))) {
-        buffer[length] = uart_getc(UART_FPGA);
-        length++;
-    }
-
+    length = uart_dma_read_peek(UART_DMA_FPGA, &data);
     if (length > 0) {
         if (fpga_loopback_active) {
+            buffer = uart_dma_write_buffer(UART_DMA_FPGA, &capacity);
+            if (buffer == NULL) capacity = 0;
+            if (length > capacity) length = capacity;
             for (uint32_t position = 0; position < length; position++) {
-                buffer[position] = buffer[position] ^ 0xa5;
+                buffer[position] = data[position] ^ 0xa5;
             }
-            uart_write_blocking(UART_FPGA, buffer, length);
+            uart_dma_write_commit(UART_DMA_FPGA, length);
+        } else if (console_history_replaying(UART_DMA_FPGA)) {
+            console_history_capture(UART_DMA_FPGA, data, length);
         } else {
             if (get_webusb_connected(WEBUSB_IDX_FPGA)) {
-                tud_vendor_n_write(WEBUSB_IDX_FPGA, buffer, length);
-                tud_vendor_n_flush(WEBUSB_IDX_FPGA);
+                if (!usb_benchmark_active(WEBUSB_IDX_FPGA)) {
+                    length = tud_vendor_n_write(WEBUSB_IDX_FPGA, data, length);
+                    usb_stats_in(USB_STATS_WEBUSB_FPGA, length);
+                    uart_stats_usb_level(UART_DMA_FPGA, CFG_TUD_VENDOR_TX_BUFSIZE - tud_vendor_n_write_available(WEBUSB_IDX_FPGA));
+                }
             } else {
-                cdc_send(1, buffer, length);
+                length = cdc_send(1, data, length);
             }
+            usb_flush_written(WEBUSB_IDX_FPGA, data, length);
+            console_history_capture(UART_DMA_FPGA, data, length);
         }
+        uart_dma_read_advance(UART_DMA_FPGA, length);
     }
-
-    if (tud_cdc_n_available(USB_CDC_ESP32) && !get_webusb_connected(WEBUSB_IDX_ESP32)) {
-        length = tud_cdc_n_read(USB_CDC_ESP32, buffer, sizeof(buffer));
-        uart_write_blocking(UART_ESP32, buffer, length);
+    if (console_history_replaying(UART_DMA_FPGA)) console_replay(WEBUSB_IDX_FPGA);
+
+    usb_flush_expired();
+
+    // USB to UART, read into a free DMA staging buffer, the USB FIFO holds the data while both buffers are busy
+    if (tud_cdc_n_available(USB_CDC_ESP32) && !get_webusb_connected(WEBUSB_IDX_ESP32) && !esp32_loader_active()) {
+        buffer = uart_dma_write_buffer(UART_DMA_ESP32, &capacity);
+        if (buffer != NULL) {
+            length = tud_cdc_n_read(USB_CDC_ESP32, buffer, capacity);
+            usb_stats_out(USB_STATS_CDC_ESP32, length);
+            esptool_sniffer_host(buffer, length);
+            uart_dma_write_commit(UART_DMA_ESP32, length);
+        }
     }
 
     if (tud_cdc_n_available(USB_CDC_FPGA) && !fpga_loopback_active && !get_webusb_connected(WEBUSB_IDX_FPGA)) {
-        length = tud_cdc_n_read(USB_CDC_FPGA, buffer, sizeof(buffer));
-        uart_write_blocking(UART_FPGA, buffer, length);
+        buffer = uart_dma_write_buffer(UART_DMA_FPGA, &capacity);
+        if (buffer != NULL) {
+            length = tud_cdc_n_read(USB_CDC_FPGA, buffer, capacity);
+            usb_stats_out(USB_STATS_CDC_FPGA, length);
+            uart_dma_write_commit(UART_DMA_FPGA, length);
+        }
     }
 
     absolute_time_t now = get_absolute_time();
@@ -257,6 +383,7 @@ void uart_task(void) {
 }
 
 void tud_cdc_line_coding_cb(uint8_t itf, cdc_line_coding_t const* new_line_coding) {
+    trace_event(TRACE_EVENT_LINE_CODING, itf, (new_line_coding->bit_rate / 100 > UINT16_MAX) ? UINT16_MAX : new_line_coding->bit_rate / 100);
     if (itf == USB_CDC_ESP32) {
         memcpy(&cdc_requested_line_coding[0], new_line_coding, sizeof(cdc_line_coding_t));
     }
@@ -267,6 +394,7 @@ void tud_cdc_line_coding_cb(uint8_t itf, cdc_line_coding_t const* new_line_codin
 
 void esp32_reset(bool download_mode) {
     if (esp32_reset_active) return;
+    trace_event(TRACE_EVENT_ESP32_RESET, download_mode, 0);
     esp32_reset_active = true;
     gpio_put(FPGA_RESET, false);    // Always disable the FPGA if the ESP32 gets reset
     gpio_put(ESP32_EN_PIN, false);  // Disable the ESP32
@@ -277,6 +405,13 @@ void esp32_reset(bool download_mode) {
     }
     esp32_reset_timeout = delayed_by_ms(get_absolute_time(), 1);
 
+    // The loader starts at its default rate again
+    esptool_sniffer_reset();
+    if (esptool_restore_baudrate != 0) {
+        esp32_requested_line_coding()->bit_rate = esptool_restore_baudrate;
+        esptool_restore_baudrate                = 0;
+    }
+
     esp32_reset_state     = 0;
     esp32_reset_app_state = 0;
 }
@@ -287,6 +422,27 @@ void webusb_set_uart_baudrate(uint8_t index, uint32_t baudrate) {
     webusb_requested_line_coding[usb_cdcs[index]].bit_rate = baudrate;
 }
 
+void uart_reapply_line_coding(uint8_t itf) { memset(&current_line_coding[itf], 0, sizeof(cdc_line_coding_t)); }
+
+const uart_baudrate_t* uart_get_baudrate(uint8_t index) {
+    static uart_baudrate_t info;
+    uint8_t                usb_cdcs[] = {USB_CDC_ESP32, USB_CDC_FPGA};
+    if (index >= sizeof(usb_cdcs)) return NULL;
+    uint8_t itf    = usb_cdcs[index];
+    info.requested = current_line_coding[itf].bit_rate;
+    info.actual    = actual_baudrate[itf];
+    info.error_ppm = (info.requested > 0) ? (int32_t) ((((int64_t) info.actual - info.requested) * 1000000) / info.requested) : 0;
+    info.clock     = clock_get_hz(clk_peri);
+    return &info;
+}
+
+void uart_set_flush_budget(uint8_t index, uint16_t budget_us) {
+    if (index >= 2) return;  // Ignore invalid index
+    usb_flush_budget_us[index] = budget_us;
+}
+
+uint16_t uart_get_flush_budget(uint8_t index) { return (index < 2) ? usb_flush_budget_us[index] : 0; }
+
 void fpga_loopback(bool enable) {
     fpga_loopback_active = enable;
     if (enable) {
@@ -294,9 +450,18 @@ void fpga_loopback(bool enable) {
     }
 }
 
+void tud_cdc_send_break_cb(uint8_t itf, uint16_t duration_ms) {
+    // A break from the host replays the console history of that port
+    (void) duration_ms;
+    if (itf == USB_CDC_ESP32) console_history_start_replay(UART_DMA_ESP32);
+    if (itf == USB_CDC_FPGA) console_history_start_replay(UART_DMA_FPGA);
+}
+
 bool prev_dtr = false;
 bool prev_rts = false;
 void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts) {
+    trace_event(TRACE_EVENT_LINE_STATE, itf, dtr | (rts << 1));
+    if (itf == USB_CDC_TRACE) trace_connected(dtr);
     if ((itf == USB_CDC_ESP32) && (!get_webusb_connected(WEBUSB_IDX_ESP32))) {
         bool dtr2 = dtr || prev_dtr;
         bool rts2 = rts || prev_rts;
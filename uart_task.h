@@ -8,18 +8,16 @@
 void setup_uart();
 
 // USB CDC serial port
-void uart_task(void);
-void cdc_send(uint8_t itf, uint8_t* buf, uint32_t count);
+void     uart_task(void);
+uint32_t cdc_send(uint8_t itf, const uint8_t* buf, uint32_t count);  // Returns the number of bytes that fit in the FIFO, uart_task() flushes
 
 // Hardware serial port
 void on_esp32_uart_rx();
 void on_fpga_uart_rx();
 
-// Stdio via CDC 2
-bool stdio_usb_init_cdc2();
-
 // ESP32 control
 void esp32_reset(bool download_mode);
+void uart_reapply_line_coding(uint8_t itf);  // Someone else changed the UART settings, apply the requested line coding again
 void wake_up_esp32();
 void send_interrupt_to_esp32();
 
@@ -27,4 +25,16 @@ void send_interrupt_to_esp32();
 void fpga_loopback(bool enable);
 
 // WebUSB baudrate control
-void webusb_set_uart_baudrate(uint8_t index, uint32_t baudrate);
+typedef struct __attribute__((packed)) {
+    uint32_t requested;  // Baud
+    uint32_t actual;     // Baud, as produced by the divider
+    int32_t  error_ppm;  // (actual - requested) / requested in parts per million
+    uint32_t clock;      // UART reference clock in Hz, the highest rate is clock / 16
+} uart_baudrate_t;
+
+void                   webusb_set_uart_baudrate(uint8_t index, uint32_t baudrate);
+const uart_baudrate_t* uart_get_baudrate(uint8_t index);
+
+// Console coalescing on CDC and WebUSB: UART data is held back for at most this long unless a packet fills up or a line ends
+void     uart_set_flush_budget(uint8_t index, uint16_t budget_us);
+uint16_t uart_get_flush_budget(uint8_t index);
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "usb_benchmark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+typedef struct {
+    uint8_t                 mode;
+    uint32_t                start;
+    uint8_t                 record[USB_BENCHMARK_RECORD_SIZE];  // Partially received record in sink mode
+    uint8_t                 record_length;
+    usb_benchmark_results_t results;
+} usb_benchmark_t;
+
+static usb_benchmark_t usb_benchmarks[CFG_TUD_VENDOR];
+
+void usb_benchmark_set_mode(uint8_t idx, uint8_t mode) {
+    if (idx >= CFG_TUD_VENDOR) return;
+    usb_benchmark_t* benchmark = &usb_benchmarks[idx];
+    memset(benchmark, 0, sizeof(usb_benchmark_t));
+    benchmark->mode         = (mode <= USB_BENCHMARK_LOOPBACK) ? mode : USB_BENCHMARK_OFF;
+    benchmark->results.mode = benchmark->mode;
+    benchmark->start        = time_us_32();
+}
+
+bool usb_benchmark_active(uint8_t idx) { return (idx < CFG_TUD_VENDOR) && (usb_benchmarks[idx].mode != USB_BENCHMARK_OFF); }
+
+static void usb_benchmark_source(uint8_t idx, usb_benchmark_t* benchmark) {
+    uint8_t record[USB_BENCHMARK_RECORD_SIZE] = {0};
+    bool    sent                              = false;
+    while (tud_vendor_n_write_available(idx) >= USB_BENCHMARK_RECORD_SIZE) {
+        uint32_t timestamp = time_us_32();
+        memcpy(&record[0], &benchmark->results.sequence, sizeof(uint32_t));
+        memcpy(&record[4], &timestamp, sizeof(uint32_t));
+        tud_vendor_n_write(idx, record, USB_BENCHMARK_RECORD_SIZE);
+        benchmark->results.sequence++;
+        benchmark->results.records++;
+        benchmark->results.bytes += USB_BENCHMARK_RECORD_SIZE;
+        sent = true;
+    }
+    if (sent) tud_vendor_n_flush(idx);
+}
+
+static void usb_benchmark_sink(uint8_t idx, usb_benchmark_t* benchmark) {
+    uint8_t  buffer[256];
+    uint32_t length = tud_vendor_n_read(idx, buffer, sizeof(buffer));
+    benchmark->results.bytes += length;
+
+    // Records can be split over reads, reassemble them before checking the sequence number
+    for (uint32_t position = 0; position < length; position++) {
+        benchmark->record[benchmark->record_length++] = buffer[position];
+        if (benchmark->record_length < USB_BENCHMARK_RECORD_SIZE) continue;
+        benchmark->record_length = 0;
+
+        uint32_t sequence;
+        memcpy(&sequence, &benchmark->record[0], sizeof(uint32_t));
+        benchmark->results.records++;
+        if (benchmark->results.records > 1) {
+            int32_t gap = (int32_t) (sequence - benchmark->results.sequence);  // Signed, so a wrapping counter still counts forward
+            if (gap < 0) {
+                benchmark->results.reordered++;  // Keep expecting the highest sequence number seen so far
+                continue;
+            }
+            benchmark->results.dropped += gap;
+        }
+        benchmark->results.sequence = sequence + 1;
+    }
+}
+
+static void usb_benchmark_loopback(uint8_t idx, usb_benchmark_t* benchmark) {
+    uint8_t  buffer[256];
+    uint32_t space = tud_vendor_n_write_available(idx);
+    if (space == 0) return;  // Let the host back off instead of dropping data
+    uint32_t length = tud_vendor_n_read(idx, buffer, (space < sizeof(buffer)) ? space : sizeof(buffer));
+    if (length == 0) return;
+    tud_vendor_n_write(idx, buffer, length);
+    tud_vendor_n_flush(idx);
+    benchmark->results.bytes += length;
+}
+
+void usb_benchmark_task(uint8_t idx) {
+    usb_benchmark_t* benchmark = &usb_benchmarks[idx];
+    switch (benchmark->mode) {
+        case USB_BENCHMARK_SOURCE:
+            usb_benchmark_source(idx, benchmark);
+            break;
+        case USB_BENCHMARK_SINK:
+            usb_benchmark_sink(idx, benchmark);
+            break;
+        case USB_BENCHMARK_LOOPBACK:
+            usb_benchmark_loopback(idx, benchmark);
+            break;
+        default:
+            break;
+    }
+}
+
+const usb_benchmark_results_t* usb_benchmark_results(uint8_t idx) {
+    usb_benchmark_t* benchmark    = &usb_benchmarks[idx % CFG_TUD_VENDOR];
+    benchmark->results.elapsed_us = time_us_32() - benchmark->start;
+    return &benchmark->results;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+    USB_BENCHMARK_OFF,       // Normal UART bridge
+    USB_BENCHMARK_SOURCE,    // Badge sends numbered records as fast as the host reads them
+    USB_BENCHMARK_SINK,      // Badge consumes numbered records and counts gaps in the sequence
+    USB_BENCHMARK_LOOPBACK,  // Badge sends everything back unchanged
+};
+
+#define USB_BENCHMARK_RECORD_SIZE 64  // 32-bit sequence number, 32-bit timestamp, padding
+
+typedef struct __attribute__((packed)) {
+    uint8_t  mode;
+    uint32_t records;     // Records sent (source) or received (sink), loopback only counts bytes
+    uint32_t bytes;
+    uint32_t dropped;     // Sequence numbers missing in the sink stream
+    uint32_t sequence;    // Next expected (sink) or next sent (source) sequence number
+    uint32_t elapsed_us;  // Time since the mode was selected
+    uint32_t reordered;   // Sink records with a sequence number below the expected one, repeated or out of order
+} usb_benchmark_results_t;
+
+void usb_benchmark_set_mode(uint8_t idx, uint8_t mode);
+bool usb_benchmark_active(uint8_t idx);
+void usb_benchmark_task(uint8_t idx);
+
+const usb_benchmark_results_t* usb_benchmark_results(uint8_t idx);
@@ -21,6 +21,7 @@ char const* string_desc_arr[] = {
     "FPGA console",              // 4: CDC Interface
     "WebUSB ESP32 console",      // 5: WebUSB interface
     "WebUSB FPGA console",       // 6: WebUSB interface
+    "RP2040 trace",              // 7: CDC Interface
 };
 
 enum {
@@ -31,6 +32,7 @@ enum {
     STRING_DESC_CDC_1,
     STRING_DESC_VENDOR_0,
     STRING_DESC_VENDOR_1,
+    STRING_DESC_CDC_2,
     STRING_DESC_SERIAL  // (Not in the string description array)
 };
 
@@ -113,6 +115,10 @@ uint8_t const* tud_descriptor_device_cb(void) { return (uint8_t const*) &desc_de
 #define EPNUM_VENDOR_1_OUT 0x06  // Endpoint 6: WebUSB
 #define EPNUM_VENDOR_1_IN  0x86
 
+#define EPNUM_CDC_2_NOTIF 0x87  // Endpoint 7: CDC serial port for the binary trace stream, control
+#define EPNUM_CDC_2_OUT   0x08  // Endpoint 8: CDC serial port for the binary trace stream, data
+#define EPNUM_CDC_2_IN    0x88
+
 uint8_t const desc_fs_configuration[] = {
     // Config number, interface count, string index, total length, attribute, power in mA
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
@@ -124,8 +130,12 @@ uint8_t const desc_fs_configuration[] = {
     TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_1, STRING_DESC_CDC_1, EPNUM_CDC_1_NOTIF, 8, EPNUM_CDC_1_OUT, EPNUM_CDC_1_IN, 64),
 
     // WebUSB: Interface number, string index, EP Out & IN address, EP size
-    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR_0, STRING_DESC_VENDOR_0, EPNUM_VENDOR_0_OUT, EPNUM_VENDOR_0_IN, 32),
-    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR_1, STRING_DESC_VENDOR_1, EPNUM_VENDOR_1_OUT, EPNUM_VENDOR_1_IN, 32),
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR_0, STRING_DESC_VENDOR_0, EPNUM_VENDOR_0_OUT, EPNUM_VENDOR_0_IN, CFG_TUD_VENDOR_EPSIZE),
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR_1, STRING_DESC_VENDOR_1, EPNUM_VENDOR_1_OUT, EPNUM_VENDOR_1_IN, CFG_TUD_VENDOR_EPSIZE),
+
+    // 3rd CDC, after the WebUSB interfaces to keep their interface numbers: Interface number, string index, EP notification address and size, EP data address
+    // (out, in) and size.
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_2, STRING_DESC_CDC_2, EPNUM_CDC_2_NOTIF, 8, EPNUM_CDC_2_OUT, EPNUM_CDC_2_IN, 64),
 
 };
 
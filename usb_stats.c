@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2022 Nicolai Electronics
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "usb_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#define USB_STATS_WINDOW_US 1000000
+
+static uint32_t usb_stats_out_bytes[USB_STATS_CHANNELS];
+static uint32_t usb_stats_in_bytes[USB_STATS_CHANNELS];
+static uint32_t usb_stats_window_start = 0;
+
+static usb_stats_throughput_t usb_stats_rates[USB_STATS_CHANNELS];
+
+void usb_stats_out(uint8_t channel, uint32_t length) { usb_stats_out_bytes[channel] += length; }
+
+void usb_stats_in(uint8_t channel, uint32_t length) { usb_stats_in_bytes[channel] += length; }
+
+void usb_stats_task() {
+    uint32_t now     = time_us_32();
+    uint32_t elapsed = now - usb_stats_window_start;
+    if (elapsed < USB_STATS_WINDOW_US) return;
+
+    for (uint8_t channel = 0; channel < USB_STATS_CHANNELS; channel++) {
+        usb_stats_rates[channel].out_rate = ((uint64_t) usb_stats_out_bytes[channel] * 1000000) / elapsed;
+        usb_stats_rates[channel].in_rate  = ((uint64_t) usb_stats_in_bytes[channel] * 1000000) / elapsed;
+        usb_stats_out_bytes[channel]      = 0;
+        usb_stats_in_bytes[channel]       = 0;
+    }
+    usb_stats_window_start = now;
+}
+
+const usb_stats_throughput_t* usb_stats_throughput() { return usb_stats_rates; }
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+    USB_STATS_CDC_ESP32,
+    USB_STATS_CDC_FPGA,
+    USB_STATS_WEBUSB_ESP32,
+    USB_STATS_WEBUSB_FPGA,
+    USB_STATS_CHANNELS,
+};
+
+// Bytes per second over the last measurement window, as returned by the get throughput vendor request
+typedef struct __attribute__((packed)) {
+    uint32_t out_rate;  // Host to badge
+    uint32_t in_rate;   // Badge to host
+} usb_stats_throughput_t;
+
+void usb_stats_out(uint8_t channel, uint32_t length);
+void usb_stats_in(uint8_t channel, uint32_t length);
+void usb_stats_task();
+
+const usb_stats_throughput_t* usb_stats_throughput();  // Array of USB_STATS_CHANNELS entries
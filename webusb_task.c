@@ -5,14 +5,25 @@
 #include <string.h>
 
 #include "bsp/board.h"
+#include "console_history.h"
+#include "crash_record.h"
+#include "esp32_loader.h"
+#include "esptool_sniffer.h"
 #include "hardware.h"
 #include "hardware/irq.h"
 #include "hardware/uart.h"
 #include "i2c_peripheral.h"
 #include "pico/stdlib.h"
+#include "profiler.h"
+#include "trace.h"
 #include "tusb.h"
+#include "uart_dma.h"
+#include "uart_flow.h"
+#include "uart_stats.h"
 #include "uart_task.h"
+#include "usb_benchmark.h"
 #include "usb_descriptors.h"
+#include "usb_stats.h"
 #include "version.h"
 
 uint16_t webusb_status[CFG_TUD_VENDOR]         = {0x0000};
@@ -30,6 +41,9 @@ uint16_t webusb_fpga_status                      = 0x0000;
 bool     webusb_fpga_baudrate_override_requested = false;
 uint32_t webusb_fpga_baudrate_override_value     = 0;
 
+uint32_t             webusb_baudrate_data = 0;  // Data stage of the 32-bit set baudrate request
+esp32_loader_start_t webusb_loader_start;       // Data stage of the start ESP32 flashing request
+
 void webusb_task() {
     if (webusb_esp32_reset_requested) {
         esp32_reset(webusb_esp32_reset_mode);  // Value controls the mode: 1 for download mode, 0 for normal mode
@@ -50,17 +64,31 @@ void webusb_task() {
         webusb_esp32_mode_change_requested = false;
     }
 
+    usb_stats_task();
+
     // Data transfer
     for (uint8_t idx = 0; idx < CFG_TUD_VENDOR; idx++) {
+        if (usb_benchmark_active(idx)) {
+            usb_benchmark_task(idx);  // Benchmark traffic never reaches the UART
+            continue;
+        }
         int available = tud_vendor_n_available(idx);
-        if (available > 0) {
-            uint8_t  buffer[256];
-            uint32_t length = tud_vendor_n_read(idx, buffer, sizeof(buffer));
-            if (idx == WEBUSB_IDX_ESP32) {
-                uart_write_blocking(UART_ESP32, buffer, length);
-            } else if (idx == WEBUSB_IDX_FPGA) {
-                uart_write_blocking(UART_FPGA, buffer, length);
-            }
+        if ((available > 0) && (idx == WEBUSB_IDX_ESP32) && esp32_loader_active()) {
+            uint32_t capacity;
+            uint8_t* buffer = esp32_loader_buffer(&capacity);
+            if (buffer == NULL) continue;  // The ROM is still busy with the previous block
+            uint32_t length = tud_vendor_n_read(idx, buffer, capacity);
+            usb_stats_out(USB_STATS_WEBUSB_ESP32, length);
+            esp32_loader_commit(length);
+        } else if (available > 0) {
+            uint8_t  port = (idx == WEBUSB_IDX_ESP32) ? UART_DMA_ESP32 : UART_DMA_FPGA;
+            uint32_t capacity;
+            uint8_t* buffer = uart_dma_write_buffer(port, &capacity);
+            if (buffer == NULL) continue;  // Both staging buffers are on their way out, keep the data in the USB FIFO
+            uint32_t length = tud_vendor_n_read(idx, buffer, capacity);
+            usb_stats_out((idx == WEBUSB_IDX_ESP32) ? USB_STATS_WEBUSB_ESP32 : USB_STATS_WEBUSB_FPGA, length);
+            if (idx == WEBUSB_IDX_ESP32) esptool_sniffer_host(buffer, length);
+            uart_dma_write_commit(port, length);
         }
     }
 }
@@ -85,7 +113,21 @@ uint16_t get_webusb_status(uint8_t idx) {
 }
 
 bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const* request) {
+    if ((stage == CONTROL_STAGE_DATA) && (request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS) && (request->bRequest == 0x2C)) {
+        if (request->wIndex == ITF_NUM_VENDOR_0) {
+            webusb_esp32_baudrate_override_requested = true;
+            webusb_esp32_baudrate_override_value     = webusb_baudrate_data;
+        } else if (request->wIndex == ITF_NUM_VENDOR_1) {
+            webusb_fpga_baudrate_override_requested = true;
+            webusb_fpga_baudrate_override_value     = webusb_baudrate_data;
+        }
+        return true;
+    }
+    if ((stage == CONTROL_STAGE_DATA) && (request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS) && (request->bRequest == 0x33)) {
+        return esp32_loader_start(&webusb_loader_start);
+    }
     if (stage != CONTROL_STAGE_SETUP) return true;  // nothing to with DATA & ACK stage
+    trace_event(TRACE_EVENT_VENDOR_REQUEST, request->bRequest, request->wValue);
 
     switch (request->bmRequestType_bit.type) {
         case TUSB_REQ_TYPE_VENDOR:
@@ -154,6 +196,100 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
                     uint8_t version = FW_VERSION;
                     return tud_control_xfer(rhport, request, (void*) &version, 1);
                 }
+                if (request->bRequest == 0x29) {  // Set benchmark mode: 0 bridge, 1 source, 2 sink, 3 loopback
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) {
+                        usb_benchmark_set_mode(request->wIndex - ITF_NUM_VENDOR_0, request->wValue & 0xFF);
+                        return tud_control_status(rhport, request);
+                    }
+                }
+                if (request->bRequest == 0x2A) {  // Get benchmark results
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) {
+                        return tud_control_xfer(rhport, request, (void*) usb_benchmark_results(request->wIndex - ITF_NUM_VENDOR_0),
+                                                sizeof(usb_benchmark_results_t));
+                    }
+                }
+                if (request->bRequest == 0x28) {  // Get throughput: bytes per second out and in for CDC ESP32, CDC FPGA, WebUSB ESP32 and WebUSB FPGA
+                    return tud_control_xfer(rhport, request, (void*) usb_stats_throughput(), sizeof(usb_stats_throughput_t) * USB_STATS_CHANNELS);
+                }
+                if (request->bRequest == 0x2B) {  // Get port statistics, wValue 1 resets the counters after taking the snapshot
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) {
+                        uint8_t port = (request->wIndex == ITF_NUM_VENDOR_0) ? UART_DMA_ESP32 : UART_DMA_FPGA;
+                        return tud_control_xfer(rhport, request, (void*) uart_stats_snapshot(port, request->wValue & 1), sizeof(uart_stats_t));
+                    }
+                }
+                if (request->bRequest == 0x2C) {  // Set baudrate, 32-bit little endian baud in the data stage
+                    if (((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) && (request->wLength == sizeof(webusb_baudrate_data))) {
+                        return tud_control_xfer(rhport, request, (void*) &webusb_baudrate_data, sizeof(webusb_baudrate_data));
+                    }
+                }
+                if (request->bRequest == 0x2D) {  // Get baudrate: requested and actual rate, error and UART clock
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) {
+                        return tud_control_xfer(rhport, request, (void*) uart_get_baudrate(request->wIndex - ITF_NUM_VENDOR_0), sizeof(uart_baudrate_t));
+                    }
+                }
+                if (request->bRequest == 0x2E) {  // Set flow control: 0 none, 1 RTS/CTS, 2 XON/XOFF
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) {
+                        uart_flow_set((request->wIndex == ITF_NUM_VENDOR_0) ? UART_DMA_ESP32 : UART_DMA_FPGA, request->wValue & 0xFF);
+                        return tud_control_status(rhport, request);
+                    }
+                }
+                if (request->bRequest == 0x2F) {  // Get flow control
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) {
+                        uint8_t mode = uart_flow_get((request->wIndex == ITF_NUM_VENDOR_0) ? UART_DMA_ESP32 : UART_DMA_FPGA);
+                        return tud_control_xfer(rhport, request, (void*) &mode, 1);
+                    }
+                }
+                if (request->bRequest == 0x30) {  // Set console flush budget in microseconds, 0 flushes after every write
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) {
+                        uart_set_flush_budget(request->wIndex - ITF_NUM_VENDOR_0, request->wValue);
+                        return tud_control_status(rhport, request);
+                    }
+                }
+                if (request->bRequest == 0x31) {  // Get console flush budget
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) {
+                        uint16_t budget = uart_get_flush_budget(request->wIndex - ITF_NUM_VENDOR_0);
+                        return tud_control_xfer(rhport, request, (void*) &budget, sizeof(budget));
+                    }
+                }
+                if (request->bRequest == 0x32) {  // Follow esptool baud rate changes on the ESP32 port: wValue 1 on (default), 0 off
+                    if (request->wIndex == ITF_NUM_VENDOR_0) {
+                        esptool_sniffer_enable(request->wValue & 1);
+                        return tud_control_status(rhport, request);
+                    }
+                }
+                if (request->bRequest == 0x33) {  // Start flashing the ESP32 from a deflate stream that follows on the bulk endpoint
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) && (request->wLength == sizeof(esp32_loader_start_t)) && !esp32_loader_active()) {
+                        return tud_control_xfer(rhport, request, (void*) &webusb_loader_start, sizeof(esp32_loader_start_t));
+                    }
+                }
+                if (request->bRequest == 0x34) {  // Get ESP32 flashing status
+                    if (request->wIndex == ITF_NUM_VENDOR_0) {
+                        return tud_control_xfer(rhport, request, (void*) esp32_loader_status(), sizeof(esp32_loader_status_t));
+                    }
+                }
+                if (request->bRequest == 0x35) {  // Abort ESP32 flashing
+                    if (request->wIndex == ITF_NUM_VENDOR_0) {
+                        esp32_loader_abort();
+                        return tud_control_status(rhport, request);
+                    }
+                }
+                if (request->bRequest == 0x36) {  // Replay the console history
+                    if ((request->wIndex == ITF_NUM_VENDOR_0) || (request->wIndex == ITF_NUM_VENDOR_1)) {
+                        console_history_start_replay(request->wIndex - ITF_NUM_VENDOR_0);
+                        return tud_control_status(rhport, request);
+                    }
+                }
+                if (request->bRequest == 0x37) {  // Get the crash record from before the last reboot, empty when there is none
+                    const crash_record_t* record = crash_record_get();
+                    return tud_control_xfer(rhport, request, (void*) record, (record != NULL) ? sizeof(crash_record_t) : 0);
+                }
+                if (request->bRequest == 0x38) {  // Discard the crash record
+                    crash_record_clear();
+                    return tud_control_status(rhport, request);
+                }
+                if (request->bRequest == 0x39) {  // Get the superloop profile, wValue 1 resets the counters after taking the snapshot
+                    return tud_control_xfer(rhport, request, (void*) profiler_snapshot(request->wValue & 1), sizeof(profiler_stats_t));
+                }
 
                 break;
             }
@@ -15,4 +15,14 @@ void ws2812_enable(bool rgbw) { ws2812_program_init(WS2812_PIO, 0, pio_offset, S
 
 void ws2812_disable() { pio_sm_set_enabled(WS2812_PIO, 0, false); }
 
-void ws2812_put(uint32_t data) { pio_sm_put_blocking(WS2812_PIO, 0, data); }
+void ws2812_put(uint32_t data) {
+    pio_sm_put_blocking(WS2812_PIO, 0, data);
+    WS2812_PIO->fdebug = 1u << PIO_FDEBUG_TXSTALL_LSB;  // Set again as soon as the state machine runs dry
+}
+
+bool ws2812_busy() {
+    if (!(WS2812_PIO->ctrl & (1u << PIO_CTRL_SM_ENABLE_LSB))) return false;
+    return !pio_sm_is_tx_fifo_empty(WS2812_PIO, 0) || !(WS2812_PIO->fdebug & (1u << PIO_FDEBUG_TXSTALL_LSB));
+}
+
+void ws2812_clock_changed() { pio_sm_set_clkdiv(WS2812_PIO, 0, clock_get_hz(clk_sys) / (800000.0f * (ws2812_T1 + ws2812_T2 + ws2812_T3))); }